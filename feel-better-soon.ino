@@ -1,6 +1,10 @@
+#include <LittleFS.h>
 #include <ESP8266WiFi.h>
 
+#include "ota.h"
+#include "json.h"
 #include "iomux.h"
+#include "scheduler.h"
 #include "httpserver.h"
 #include "pages.h"
 
@@ -21,29 +25,249 @@ static const char StatusTab[][16] PROGMEM = {
     "DISCONNECTED",
 };
 
-static HttpResponse http_GET_root(const HttpRequest &req);
+static HttpResponse http_GET_stats(const HttpRequest &req);
+static HttpResponse http_GET_tasks(const HttpRequest &req);
+static HttpResponse http_DELETE_stats(const HttpRequest &req);
+static HttpResponse http_GET_events(const HttpRequest &req);
+static HttpResponse http_POST_firmware(const HttpRequest &req);
+
+static bool sink_POST_firmware(const HttpRequest &req, size_t off, const char *buf, size_t len);
+
+static const char TYPE_text_plain[] PROGMEM = "text/plain";
+static const char HTTP_no_content[] PROGMEM = "HTTP/1.1 204 No Content\r\n\r\n";
+static const char HEAD_json_stream[] PROGMEM =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/json\r\n";
+
+static const char PATH_stats[]    PROGMEM = "/stats";
+static const char PATH_tasks[]    PROGMEM = "/tasks";
+static const char PATH_events[]   PROGMEM = "/events";
+static const char PATH_firmware[] PROGMEM = "/firmware";
 
 static const HttpRoutingTable HttpRoutes[] PROGMEM = {
-    { HttpMethod::GET, "/", http_GET_root },
+    { HttpMethod::GET   , PATH_stats   , http_GET_stats     , nullptr            },
+    { HttpMethod::DELETE, PATH_stats   , http_DELETE_stats  , nullptr            },
+    { HttpMethod::GET   , PATH_tasks   , http_GET_tasks     , nullptr            },
+    { HttpMethod::GET   , PATH_events  , http_GET_events    , nullptr            },
+    { HttpMethod::POST  , PATH_firmware, http_POST_firmware , sink_POST_firmware },
     {},
 };
 
-static uint32_t    _blink  = 0;
-static HttpServer  _server = HttpServer(SERVER_PORT, HttpRoutes);
-static wl_status_t _status = WL_IDLE_STATUS;
-
-static HttpResponse http_GET_root(const HttpRequest &req) {
-    printf("request body is %d bytes long\n", req.body.size());
-    printf("method is %d\n", req.method);
-    printf("path is %.*s\n", req.path.size(), req.path.data());
-    printf("query is %.*s\n", req.query.size(), req.query.data());
-    printf("headers:\n");
-    for (int i = 0; i != req.headers.size(); i++) {
-        printf("%.*s: %.*s\n", req.headers[i].name.size(), req.headers[i].name.data(),
-            req.headers[i].value.size(), req.headers[i].value.data());
+static bool            _blink  = false;
+static HttpServer      _server = HttpServer(SERVER_PORT, HttpRoutes, &PagesBundle, &LittleFS);
+static wl_status_t     _status = WL_IDLE_STATUS;
+static HttpEventStream _events;
+
+static HttpResponse http_GET_stats(const HttpRequest &req) {
+    char   buf[384];
+    size_t len  = 0;
+    auto & stat = _server.stats();
+    auto & spi  = iomux_stats();
+
+    /* format the scheduler statistics, one line per task, times are in microseconds */
+    for (size_t i = 0; i < sched_count(); i++) {
+        auto task = sched_stats(i);
+        auto runs = std::max<uint32_t>(task->runs, 1);
+
+        /* append to the buffer, truncated if it does not fit */
+        len += snprintf(
+            &buf[len],
+            sizeof(buf) - len,
+            "task %s runs %u avg %u max %u late %u/%u deferred %u\n",
+            task->name,
+            task->runs,
+            static_cast<uint32_t>(task->run_total / runs),
+            task->run_max,
+            static_cast<uint32_t>(task->late_total / runs),
+            task->late_max,
+            task->deferred
+        );
+
+        /* keep the terminator */
+        len = std::min(len, sizeof(buf) - 1);
     }
-    printf("body: %.*s\n", req.body.size(), req.body.data());
-    return HttpResponse(DATA_index_html, SIZE_index_html);
+
+    /* requests per second, latency percentiles (in microseconds) and header parser
+     * cycles per byte (in hundredths) since the last reset, the I/O expander ones since boot */
+    auto secs  = std::max<uint32_t>((millis() - stat.since) / 1000, 1);
+    auto parse = static_cast<uint32_t>(stat.parse_cycles * 100 / std::max<uint32_t>(stat.parse_bytes, 1));
+    auto body = req.arena->sprintf(
+        "accepted %u\nrejected %u\nrequests %u\nreused %u\nskipped %u\ndropped %u\nevicted %u\ntaken %u\nwaited %u\narena %u\n"
+        "rate %u\nlatency %u/%u/%u\nparse %u.%02u\niomux batches %u frames %u cycles %u irqs %u uart %u/%u\n%.*s",
+        stat.accepted,
+        stat.rejected,
+        stat.requests,
+        stat.reused,
+        stat.skipped,
+        stat.dropped,
+        stat.evicted,
+        stat.taken,
+        stat.waited,
+        stat.arena,
+        stat.requests / secs,
+        stat.percentile(50),
+        stat.percentile(90),
+        stat.percentile(99),
+        parse / 100,
+        parse % 100,
+        spi.batches,
+        spi.frames,
+        static_cast<uint32_t>(spi.cycles / std::max<uint32_t>(spi.batches, 1)),
+        spi.irqs,
+        spi.rx,
+        spi.tx,
+        static_cast<int>(len),
+        buf
+    );
+
+    /* build the response */
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, body.size());
+    resp.add(body);
+    return resp;
+}
+
+struct TasksJson {
+    size_t     index = 0;
+    uint8_t    field = 0;
+    JsonWriter json;
+};
+
+/* microseconds for JsonWriter::fixed(), which takes 32 bits signed */
+static int32_t json_micros(uint64_t us) {
+    return static_cast<int32_t>(std::min<uint64_t>(us, INT32_MAX));
+}
+
+static size_t json_GET_tasks(void *ctx, char *buf, size_t len) {
+    size_t n  = 0;
+    auto   st = static_cast<TasksJson *>(ctx);
+
+    /* one field at a time, so that the staging buffer never holds more than a single field */
+    for (;;) {
+        n += st->json.drain(&buf[n], len - n);
+
+        /* chunk is full, or everything was sent */
+        if (n == len || st->index > sched_count()) {
+            return n;
+        }
+
+        /* close the array after the last task */
+        if (st->index == sched_count()) {
+            st->json.end_array();
+            st->index++;
+            continue;
+        }
+
+        /* times are in milliseconds */
+        auto task = sched_stats(st->index);
+        auto runs = std::max<uint32_t>(task->runs, 1);
+
+        /* serialize the next field of the task */
+        switch (st->field++) {
+            case 0  : st->json.begin_object().key("name").string(task->name); break;
+            case 1  : st->json.key("runs").number(task->runs); break;
+            case 2  : st->json.key("run_avg").fixed(json_micros(task->run_total / runs), 3); break;
+            case 3  : st->json.key("run_max").fixed(json_micros(task->run_max), 3); break;
+            case 4  : st->json.key("late_avg").fixed(json_micros(task->late_total / runs), 3); break;
+            case 5  : st->json.key("late_max").fixed(json_micros(task->late_max), 3); break;
+            default : st->json.key("deferred").number(task->deferred).end_object(); st->field = 0; st->index++; break;
+        }
+
+        /* a field that does not fit would be dropped, end the body rather than send broken JSON */
+        if (st->json.overflow()) {
+            return HTTP_STREAM_ABORT;
+        }
+    }
+}
+
+static HttpResponse http_DELETE_stats(const HttpRequest &req) {
+    _server.reset_stats();
+    return HttpResponse(HTTP_no_content);
+}
+
+static HttpResponse http_GET_tasks(const HttpRequest &req) {
+    auto st = req.arena->alloc<TasksJson>(1);
+
+    /* the state lives in the arena, so it lasts as long as the response */
+    if (st == nullptr) {
+        return HttpResponse::error(*req.arena, 500);
+    }
+
+    /* stream the tasks */
+    new (st) TasksJson;
+    st->json.begin_array();
+    return HttpResponse::stream(HEAD_json_stream, json_GET_tasks, st);
+}
+
+static HttpResponse http_GET_events(const HttpRequest &req) {
+    return HttpResponse::subscribe(_events);
+}
+
+static bool sink_POST_firmware(const HttpRequest &req, size_t off, const char *buf, size_t len) {
+    if (off == 0) {
+        auto hash = req.header("x-firmware-sha256");
+        auto size = req.header(HttpHeaderId::ContentLength);
+
+        /* the image size must be known upfront, chunked uploads are refused, the request identifies the uploader */
+        if (!ota_begin(&req, size.empty() ? 0 : strtoul(size.data(), nullptr, 10), hash.data(), hash.size())) {
+            return false;
+        }
+    }
+
+    /* write into the update partition */
+    return ota_write(buf, len);
+}
+
+static HttpResponse http_POST_firmware(const HttpRequest &req) {
+    uint16_t code;
+    auto &   stat = ota_stats();
+    auto     size = req.header(HttpHeaderId::ContentLength);
+
+    /* the sink never ran without a body, the status would be left from the previous attempt */
+    if (size.empty() || size == "0") {
+        return HttpResponse::error(*req.arena, size.empty() ? 411 : 400);
+    }
+
+    /* another connection owns the update, or it is already over, its status is none of our business */
+    if (ota_owner() != &req) {
+        return HttpResponse::error(*req.arena, 409);
+    }
+
+    /* verify and commit the image once it was fully received */
+    if (ota_status() == OtaStatus::Running) {
+        ota_end();
+    }
+
+    /* the outcome is ours, later uploads must not see it */
+    ota_release(&req);
+
+    /* map the update status to the response */
+    switch (ota_status()) {
+        case OtaStatus::Done       : code = 200; break;
+        case OtaStatus::NoSpace    : code = 413; break;
+        case OtaStatus::FlashError : code = 500; break;
+        default                    : code = 400; break;
+    }
+
+    /* the update failed */
+    if (code != 200) {
+        return HttpResponse::error(*req.arena, code);
+    }
+
+    /* report the throughput and the heap used during the update */
+    auto body = req.arena->sprintf(
+        "size %u\nelapsed %u\nrate %u\nheap %u\n",
+        stat.size,
+        stat.elapsed,
+        static_cast<uint32_t>(static_cast<uint64_t>(stat.size) * 1000 / 1024 / std::max<uint32_t>(stat.elapsed, 1)),
+        stat.heap_start - stat.heap_min
+    );
+
+    /* build the response, the device reboots shortly after */
+    Serial.printf("Firmware updated: %.*s", static_cast<int>(body.size()), body.data());
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, body.size(), "Connection: close\r\n");
+    resp.add(body);
+    resp.close = true;
+    return resp;
 }
 
 static void on_status_changed(wl_status_t status) {
@@ -55,9 +279,9 @@ static void on_status_changed(wl_status_t status) {
 
 static void blink_poll() {
     if (WiFi.status() == WL_CONNECTED) {
-        digitalWrite(LED_BUILTIN, (_blink = 0));
+        digitalWrite(LED_BUILTIN, (_blink = false));
     } else {
-        digitalWrite(LED_BUILTIN, (++_blink & 0x8000) >> 15);
+        digitalWrite(LED_BUILTIN, (_blink = !_blink));
     }
 }
 
@@ -68,6 +292,18 @@ static void status_poll() {
     }
 }
 
+static void events_poll() {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"uptime\":%lu,\"heap\":%u}", millis(), ESP.getFreeHeap());
+    _events.publish("heartbeat", buf);
+}
+
+static void iomux_changed(const IomuxEvent &ev) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"time\":%u,\"changed\":%u,\"state\":%u}", ev.time, ev.changed, ev.state);
+    _events.publish("pins", buf);
+}
+
 static void server_poll() {
     if (WiFi.status() == WL_CONNECTED) {
         _server.poll();
@@ -85,10 +321,16 @@ void setup() {
     Serial.println("Device is starting ...");
     Serial.flush();
 
+    /* mount the filesystem, files are served after the built-in pages */
+    if (!LittleFS.begin()) {
+        Serial.println("Cannot mount filesystem.");
+    }
+
     /* initialize the I/O multiplexer */
     iomux_init();
     iomux_io_dir(0xff);
     iomux_io_write(0x00);
+    iomux_write_back(true);
 
     /* initialize the LCD screen */
     // st7789_init();
@@ -97,12 +339,24 @@ void setup() {
     /* connect to Wi-Fi access point */
     WiFi.begin(AP_SSID, AP_PASSWD);
     WiFi.setAutoReconnect(true);
+
+    /* periods are in microseconds, the HTTP server takes whatever budget is left */
+    sched_periodic("status", 0, 100000, status_poll);
+    sched_periodic("blink", 1, 250000, blink_poll);
+    sched_periodic("events", 1, 1000000, events_poll);
+    sched_periodic("ota", 1, 100000, ota_poll);
+    sched_periodic("iomux", 1, 10000, iomux_flush);
+
+    /* the pin interrupt wakes its task, and is not attached if the task could not be added */
+    if (!iomux_attach(sched_event("pins", 0, iomux_service), iomux_changed)) {
+        Serial.println("Cannot attach the pin interrupt.");
+    }
+
+    sched_periodic("http", 2, 0, server_poll);
 }
 
 void loop() {
-    blink_poll();
-    status_poll();
-    server_poll();
+    sched_run();
     // int x = rand() % ST7789_WIDTH;
     // int y = rand() % ST7789_HEIGHT;
     // uint16_t color = (uint16_t)(rand());
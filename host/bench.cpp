@@ -0,0 +1,821 @@
+#include <deque>
+#include <chrono>
+#include <string>
+
+#include "host.h"
+#include "client.h"
+#include "pages.h"
+#include "json.h"
+#include "progmem.h"
+#include "picohttpparser.h"
+#include "httpserver.h"
+#include "iomux.h"
+#include "sc16is7xx.h"
+
+struct Options {
+    bool        quick    = false;
+    bool        close    = false;
+    size_t      clients  = HTTP_MAX_CONNS;
+    size_t      requests = 20000;
+    size_t      pipeline = 1;
+    std::string mix      = "mixed";
+};
+
+struct Section {
+    const char *name;
+    bool (*run)(const Options &opts);
+};
+
+struct Mix {
+    const char * name;
+    const char * const *reqs;
+};
+
+static const char *const MixBrowser[] = {
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10.15; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "\r\n",
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10.15; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "If-None-Match: \"b004548e1b6f5217\"\r\n"
+    "\r\n",
+    nullptr,
+};
+
+static const char *const MixApi[] = {
+    "GET /hello HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "\r\n",
+    "GET /samples/42?from=0&count=16 HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "Accept: application/json\r\n"
+    "\r\n",
+    "POST /echo HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "Content-Length: 64\r\n"
+    "\r\n"
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef",
+    nullptr,
+};
+
+static const char *const MixStream[] = {
+    "GET /stream HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "\r\n",
+    nullptr,
+};
+
+static const char *const MixMixed[] = {
+    MixBrowser[0],
+    MixApi[0],
+    MixApi[1],
+    MixBrowser[1],
+    MixApi[2],
+    MixStream[0],
+    nullptr,
+};
+
+static const Mix Mixes[] = {
+    { "browser" , MixBrowser },
+    { "api"     , MixApi     },
+    { "stream"  , MixStream  },
+    { "mixed"   , MixMixed   },
+};
+
+static const char TYPE_text_plain[] PROGMEM = "text/plain";
+static const char TYPE_json[]       PROGMEM = "application/json";
+static const char HEAD_stream[]     PROGMEM = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+
+static const char PATH_hello[]   PROGMEM = "/hello";
+static const char PATH_sample[]  PROGMEM = "/samples/{id}";
+static const char PATH_echo[]    PROGMEM = "/echo";
+static const char PATH_stream[]  PROGMEM = "/stream";
+
+static HttpResponse http_GET_hello(const HttpRequest &req) {
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, 6);
+    resp.add_P("hello\n", 6);
+    return resp;
+}
+
+static HttpResponse http_GET_sample(const HttpRequest &req) {
+    auto id   = req.param("id");
+    auto body = req.arena->sprintf("{\"id\":%.*s,\"red\":%u,\"ir\":%u}\n", static_cast<int>(id.size()), id.data(), 51234, 48765);
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_json, body.size());
+    resp.add(body);
+    return resp;
+}
+
+static HttpResponse http_POST_echo(const HttpRequest &req) {
+    auto body = req.arena->sprintf("%u\n", static_cast<unsigned>(req.body.size()));
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, body.size());
+    resp.add(body);
+    return resp;
+}
+
+static size_t produce_stream(void *ctx, char *buf, size_t len) {
+    auto rem = static_cast<size_t *>(ctx);
+    auto ret = std::min(*rem, len);
+
+    /* a 4 KB body in whatever pieces fit */
+    memset(buf, 'x', ret);
+    *rem -= ret;
+    return ret;
+}
+
+static HttpResponse http_GET_stream(const HttpRequest &req) {
+    auto rem = req.arena->alloc<size_t>(1);
+    *rem = 4096;
+    return HttpResponse::stream(HEAD_stream, produce_stream, rem);
+}
+
+static const HttpRoutingTable Routes[] PROGMEM = {
+    { HttpMethod::GET  , PATH_hello  , http_GET_hello  , nullptr },
+    { HttpMethod::GET  , PATH_sample , http_GET_sample , nullptr },
+    { HttpMethod::POST , PATH_echo   , http_POST_echo  , nullptr },
+    { HttpMethod::GET  , PATH_stream , http_GET_stream , nullptr },
+    {},
+};
+
+static uint64_t now_ns() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+static uint64_t percentile(std::vector<uint64_t> &vals, size_t pct) {
+    if (vals.empty()) {
+        return 0;
+    } else {
+        return vals[std::min(vals.size() - 1, vals.size() * pct / 100)];
+    }
+}
+
+struct LoadClient {
+    size_t               next = 0;
+    HostClient           conn;
+    std::deque<uint64_t> sent;
+};
+
+static bool bench_http(const Options &opts) {
+    size_t                ok      = 0;
+    size_t                failed  = 0;
+    size_t                dropped = 0;
+    size_t                issued  = 0;
+    uint64_t              allocs = 0;
+    const Mix *           mix    = nullptr;
+    std::vector<uint64_t> lat;
+
+    /* find the request mix */
+    for (const auto &v : Mixes) {
+        if (opts.mix == v.name) {
+            mix = &v;
+        }
+    }
+
+    /* check for mix name */
+    if (mix == nullptr) {
+        fprintf(stderr, "unknown mix: %s\n", opts.mix.c_str());
+        return false;
+    }
+
+    /* requests end with "Connection: close" to measure fresh connections */
+    std::vector<std::string> reqs;
+    for (auto p = mix->reqs; *p != nullptr; p++) {
+        std::string req = *p;
+        if (opts.close) {
+            req.insert(req.find("\r\n\r\n") + 2, "Connection: close\r\n");
+        }
+        reqs.push_back(std::move(req));
+    }
+
+    /* start the server */
+    auto       port  = host_free_port();
+    HttpServer srv(port, Routes, &PagesBundle);
+    auto       poll  = [&] { auto n = host_allocs(); srv.poll(); allocs += host_allocs() - n; };
+    auto       start = now_ns();
+    srv.begin();
+
+    /* the clients take turns with the server, as if every one of them was on its own phone */
+    std::vector<LoadClient> clients(opts.clients);
+    lat.reserve(opts.requests);
+    while (ok + failed + dropped < opts.requests) {
+        if (now_ns() - start > 60e9) {
+            fprintf(stderr, "http: timed out with %zu requests left\n", opts.requests - ok - failed - dropped);
+            return false;
+        }
+
+        /* one step for every client */
+        for (auto &cl : clients) {
+            HostReply reply;
+
+            /* reconnect after a close, the requests still in flight are lost,
+             * which happens when every slot was still busy at connect time */
+            if (cl.conn.closed()) {
+                dropped += cl.sent.size();
+                cl.sent.clear();
+                cl.conn.close();
+            }
+
+            /* connect on the first request */
+            if (!cl.conn.connected() && !cl.conn.connect(port)) {
+                fprintf(stderr, "cannot connect to port %u\n", port);
+                return false;
+            }
+
+            /* keep the pipeline full */
+            while (cl.sent.size() < (opts.close ? 1 : opts.pipeline) && issued < opts.requests) {
+                auto &req = reqs[cl.next++ % reqs.size()];
+                cl.sent.push_back(now_ns());
+                cl.conn.send(req, poll);
+                issued++;
+            }
+
+            /* collect the replies */
+            cl.conn.pump();
+            while (!cl.sent.empty() && cl.conn.take(reply)) {
+                lat.push_back(now_ns() - cl.sent.front());
+                cl.sent.pop_front();
+
+                /* check for status */
+                if (reply.status < 400) {
+                    ok++;
+                } else {
+                    failed++;
+                }
+            }
+
+            /* the server closes after the reply, so does the client */
+            if (opts.close && cl.sent.empty()) {
+                cl.conn.close();
+            }
+        }
+
+        /* run the server once per round */
+        poll();
+    }
+
+    /* compute the results */
+    auto &st   = srv.stats();
+    auto  secs = (now_ns() - start) / 1e9;
+    std::sort(lat.begin(), lat.end());
+
+    /* print the results */
+    printf("http: mix %s, %zu clients, pipeline %zu%s\n", mix->name, opts.clients, opts.pipeline, opts.close ? ", close" : "");
+    printf("  requests   %zu ok, %zu failed, %zu dropped\n", ok, failed, dropped);
+    printf("  rate       %.0f req/s\n", ok / secs);
+    printf("  latency    p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+        percentile(lat, 50) / 1e3,
+        percentile(lat, 90) / 1e3,
+        percentile(lat, 99) / 1e3,
+        lat.empty() ? 0.0 : lat.back() / 1e3
+    );
+    printf("  server     p50 < %u us, p99 < %u us, arena peak %u bytes\n", st.percentile(50), st.percentile(99), st.arena);
+    printf("  allocs     %.2f per request\n", static_cast<double>(allocs) / std::max<uint32_t>(st.requests, 1));
+    printf("  conns      %u accepted, %u rejected, %u reused\n", st.accepted, st.rejected, st.reused);
+    return failed == 0 && (opts.close || dropped == 0);
+}
+
+/* requests as sent by real clients, headers and all */
+static const char *const Corpus[] = {
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+    "\r\n",
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10.15; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "If-None-Match: \"b004548e1b6f5217\"\r\n"
+    "Priority: u=0, i\r\n"
+    "\r\n",
+    "GET /app.js HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: zh-CN,zh-Hans;q=0.9\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "User-Agent: Mozilla/5.0 (iPhone; CPU iPhone OS 17_5 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.5 Mobile/15E148 Safari/604.1\r\n"
+    "Referer: http://192.168.4.1:9999/\r\n"
+    "\r\n",
+    "GET /events HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "User-Agent: Mozilla/5.0 (Linux; Android 14; Pixel 8) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.6478.122 Mobile Safari/537.36\r\n"
+    "Referer: http://192.168.4.1:9999/\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: en-GB,en-US;q=0.9,en;q=0.8\r\n"
+    "\r\n",
+    "GET /ws HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "Connection: Upgrade\r\n"
+    "Pragma: no-cache\r\n"
+    "Cache-Control: no-cache\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36\r\n"
+    "Upgrade: websocket\r\n"
+    "Origin: http://192.168.4.1:9999\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+    "\r\n",
+    "GET /samples/42?from=1718000000&count=256 HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "Accept: application/json\r\n"
+    "X-Requested-With: XMLHttpRequest\r\n"
+    "\r\n",
+    "POST /firmware HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "User-Agent: curl/8.8.0\r\n"
+    "Accept: */*\r\n"
+    "Content-Length: 412336\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "X-Firmware-SHA256: 9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\r\n"
+    "\r\n",
+    "GET /stats HTTP/1.1\r\n"
+    "Host: 192.168.4.1:9999\r\n"
+    "User-Agent: curl/8.8.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+};
+
+static bool bench_parse(const Options &opts) {
+    alignas(4) char buf[HTTP_BUFFER_SIZE];
+    size_t          bytes  = 0;
+    uint64_t        whole  = 0;
+    uint64_t        split  = 0;
+    size_t          rounds = opts.quick ? 2000 : 200000;
+
+    /* the corpus as one stream of bytes, for the per-byte figures */
+    for (auto req : Corpus) {
+        bytes += strlen(req);
+    }
+
+    /* parse the whole corpus in every round */
+    for (size_t i = 0; i < rounds; i++) {
+        for (auto req : Corpus) {
+            int         minor;
+            size_t      len    = strlen(req);
+            size_t      nhdrs  = HTTP_MAX_HEADERS;
+            size_t      mlen;
+            size_t      plen;
+            const char *method;
+            const char *path;
+            phr_header  hdrs[HTTP_MAX_HEADERS];
+
+            /* requests start at the beginning of the connection buffer */
+            memcpy(buf, req, len);
+
+            /* everything at once */
+            uint32_t t0 = ESP.getCycleCount();
+            int ret = phr_parse_request(buf, len, &method, &mlen, &path, &plen, &minor, hdrs, &nhdrs, 0);
+            whole += ESP.getCycleCount() - t0;
+
+            /* check the result */
+            if (ret != static_cast<int>(len)) {
+                fprintf(stderr, "parse: failed with %d on %.*s\n", ret, static_cast<int>(plen), path);
+                return false;
+            }
+
+            /* the first half, then the rest, like a request arriving in two segments */
+            nhdrs = HTTP_MAX_HEADERS;
+            t0 = ESP.getCycleCount();
+            ret = phr_parse_request(buf, len / 2, &method, &mlen, &path, &plen, &minor, hdrs, &nhdrs, 0);
+            nhdrs = HTTP_MAX_HEADERS;
+            ret = ret != -2 ? ret : phr_parse_request(buf, len, &method, &mlen, &path, &plen, &minor, hdrs, &nhdrs, len / 2);
+            split += ESP.getCycleCount() - t0;
+
+            /* check the result */
+            if (ret != static_cast<int>(len)) {
+                fprintf(stderr, "parse: split parse failed with %d\n", ret);
+                return false;
+            }
+        }
+    }
+
+    /* print the results */
+    auto total = static_cast<double>(bytes) * rounds;
+    printf("parse: %zu requests, %zu bytes, %zu rounds\n", sizeof(Corpus) / sizeof(Corpus[0]), bytes, rounds);
+    printf("  whole      %.2f cycles/byte\n", whole / total);
+    printf("  split      %.2f cycles/byte\n", split / total);
+    return true;
+}
+
+/* counts what is printed and throws it away, like a socket that is never full */
+struct NullPrint : Print {
+    size_t bytes = 0;
+
+public:
+    size_t write(const uint8_t *buf, size_t len) override {
+        bytes += len;
+        return len;
+    }
+};
+
+/* one sample object, the shape of an event */
+static void json_sample(JsonWriter &json, uint32_t i) {
+    json.begin_object()
+        .key("seq").number(i)
+        .key("red").number(51234 + i % 97)
+        .key("ir").number(48765 + i % 89)
+        .key("temp").fixed(3650 + static_cast<int32_t>(i % 20), 2)
+        .key("label").string("finger \"on\"")
+        .end_object();
+}
+
+static bool bench_json(const Options &opts) {
+    char      buf[HTTP_CHUNK_SIZE];
+    size_t    drained = 0;
+    size_t    count   = opts.quick ? 20000 : 1000000;
+    NullPrint out;
+
+    /* straight into a Print, flushed whenever the staging buffer fills up */
+    auto t0 = now_ns();
+    JsonWriter direct(&out);
+    direct.begin_array();
+    for (uint32_t i = 0; i < count; i++) {
+        json_sample(direct, i);
+    }
+    direct.end_array();
+    direct.flush();
+
+    /* pulled in chunks by a producer, a drain after every object */
+    auto t1 = now_ns();
+    JsonWriter pulled;
+    size_t     fill = 0;
+    pulled.begin_array();
+    for (uint32_t i = 0; i < count; i++) {
+        json_sample(pulled, i);
+        fill += pulled.drain(&buf[fill], sizeof(buf) - fill);
+        if (fill == sizeof(buf)) {
+            drained += fill;
+            fill = pulled.drain(buf, sizeof(buf));
+        }
+    }
+
+    /* the rest of the body */
+    pulled.end_array();
+    drained += fill + pulled.drain(buf, sizeof(buf));
+
+    /* print the results */
+    auto t2 = now_ns();
+    printf("json: %zu objects\n", count);
+    printf("  print      %.1f MB/s, %.0f ns/object\n", out.bytes * 1e3 / (t1 - t0), static_cast<double>(t1 - t0) / count);
+    printf("  drain      %.1f MB/s, %.0f ns/object\n", drained * 1e3 / (t2 - t1), static_cast<double>(t2 - t1) / count);
+    return out.bytes == drained && !direct.overflow() && !pulled.overflow();
+}
+
+/* the dispatch the trie replaced, a strncmp_P() over every route until both the path and the method match */
+static const HttpRoutingTable *linear_find(const HttpRoutingTable *rt, const HttpRequest &req) {
+    auto path = req.path.data();
+    auto size = req.path.size();
+
+    /* find the handler */
+    for (; pgm_typed_ptr(&rt->path) != nullptr; rt++) {
+        if (!strncmp_P(path, rt->path, size) && !pgm_read_byte(&rt->path[size]) && pgm_typed_byte(&rt->method) == req.method) {
+            return rt;
+        }
+    }
+
+    /* not found */
+    return nullptr;
+}
+
+/* `count` lookups of `paths` in turn, in nanoseconds per lookup */
+template <typename Find>
+static double time_lookups(const std::vector<std::string> &paths, size_t count, Find &&find) {
+    auto t0 = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        if (!find(paths[i % paths.size()])) {
+            return -1;
+        }
+    }
+    return static_cast<double>(now_ns() - t0) / count;
+}
+
+static bool bench_route(const Options &opts) {
+    HttpRequest req;
+    size_t      count = opts.quick ? 20000 : 200000;
+
+    /* the routes of a REST-style API, ten resources per group, and a parameter route in each group */
+    printf("route: %zu lookups, ns/lookup\n", count);
+    printf("  routes     trie    linear  trie-miss  linear-miss  trie-param\n");
+    for (size_t nr : { 10, 100, 1000 }) {
+        std::vector<std::string>      paths;
+        std::vector<std::string>      hits;
+        std::vector<std::string>      misses;
+        std::vector<std::string>      params;
+        std::vector<HttpRoutingTable> table;
+
+        /* the paths must stay put once the table points into them */
+        paths.reserve(nr);
+        for (size_t i = 0; i < nr; i++) {
+            if (i % 10 == 9) {
+                paths.push_back("/api/v1/group" + std::to_string(i / 10) + "/samples/{id}");
+                params.push_back("/api/v1/group" + std::to_string(i / 10) + "/samples/" + std::to_string(i));
+            } else {
+                paths.push_back("/api/v1/group" + std::to_string(i / 10) + "/item" + std::to_string(i));
+                hits.push_back(paths.back());
+                misses.push_back(paths.back() + "x");
+            }
+        }
+
+        /* the same table for both, looked up in a scattered order */
+        for (auto &v : paths) {
+            table.push_back({ HttpMethod::GET, v.c_str(), http_GET_hello, nullptr });
+        }
+        table.push_back({});
+        for (auto v : { &hits, &misses, &params }) {
+            for (size_t i = 0; i < v->size(); i++) {
+                std::swap((*v)[i], (*v)[(i * 7919) % v->size()]);
+            }
+        }
+
+        /* both find the same route for every literal path */
+        HttpRouter router(table.data());
+        req.method = HttpMethod::GET;
+        for (auto &v : hits) {
+            bool found = false;
+            req.path = v;
+            if (router.find(req, found) != linear_find(table.data(), req) || !found) {
+                fprintf(stderr, "route: %s dispatched differently\n", v.c_str());
+                return false;
+            }
+        }
+
+        /* time each kind of lookup */
+        auto trie = [&](bool expect) {
+            return [&, expect](const std::string &path) {
+                bool found = false;
+                req.path = path;
+                return (router.find(req, found) != nullptr) == expect;
+            };
+        };
+        auto linear = [&](bool expect) {
+            return [&, expect](const std::string &path) {
+                req.path = path;
+                return (linear_find(table.data(), req) != nullptr) == expect;
+            };
+        };
+
+        /* print the results */
+        auto th = time_lookups(hits, count, trie(true));
+        auto lh = time_lookups(hits, count, linear(true));
+        auto tm = time_lookups(misses, count, trie(false));
+        auto lm = time_lookups(misses, count, linear(false));
+        auto tp = time_lookups(params, count, trie(true));
+        printf("  %-6zu %8.0f %9.0f %10.0f %12.0f %11.0f\n", nr, th, lh, tm, lm, tp);
+
+        /* every lookup gave the expected answer */
+        if (th < 0 || lh < 0 || tm < 0 || lm < 0 || tp < 0) {
+            fprintf(stderr, "route: a lookup failed with %zu routes\n", nr);
+            return false;
+        }
+    }
+    return true;
+}
+
+struct IomuxLoad {
+    const char *name;
+    size_t      ops;
+    bool        write_back;
+    void (*run)(size_t i);
+};
+
+/* register traffic of the driver's own sequences, the write-back loads flush every 8 pin changes */
+static const IomuxLoad IomuxLoads[] = {
+    { "reset"          , 1    , false , [](size_t i) { iomux_reset(); }                                                },
+    { "uart_begin"     , 1    , false , [](size_t i) { iomux_uart_begin(115200); }                                     },
+    { "io_dir"         , 1000 , false , [](size_t i) { iomux_io_dir(i & 0xff); }                                       },
+    { "pin_write"      , 1000 , false , [](size_t i) { iomux_pin_write(i & 7, i & 8); }                                },
+    { "pin_write_back" , 1000 , true  , [](size_t i) { iomux_pin_write(i & 7, i & 8); if (i % 8 == 7) iomux_flush(); } },
+    { "pin_dir_back"   , 1000 , true  , [](size_t i) { iomux_pin_dir(i & 7, i & 8); if (i % 8 == 7) iomux_flush(); }   },
+    { "pin_interrupt"  , 1000 , false , [](size_t i) { iomux_pin_interrupt(i & 7, i & 8); }                            },
+};
+
+static bool bench_iomux(const Options &opts) {
+    HostSc16is7xx chip(15);
+
+    /* every load from a freshly reset chip */
+    printf("iomux: SPI frames, with the batched write merging and without it\n");
+    printf("  load               ops   frames  unmerged  frames/op  bus us/op\n");
+    for (const auto &v : IomuxLoads) {
+        iomux_init();
+        iomux_write_back(v.write_back);
+
+        /* count what the chip sees, and what the driver counts */
+        auto before = iomux_stats();
+        chip.frames = 0;
+        host_spi_reset_stats();
+        for (size_t i = 0; i < v.ops; i++) {
+            v.run(i);
+        }
+        iomux_write_back(false);
+
+        /* the frames a batch without merging would have sent */
+        auto &after  = iomux_stats();
+        auto  frames = after.frames - before.frames;
+        auto  merged = after.merged - before.merged;
+        auto  bus    = host_spi_stats().ns / 1000.0;
+        printf("  %-16s %5zu %8u %9u %10.2f %10.2f\n", v.name, v.ops, frames, frames + merged, 1.0 * frames / v.ops, bus / v.ops);
+
+        /* the driver counts every frame the chip gets */
+        if (frames != chip.frames || frames != host_spi_stats().frames) {
+            fprintf(stderr, "iomux: %s counted %u frames, the chip saw %u\n", v.name, frames, chip.frames);
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t UartPolls = 0;
+
+/* the event task woken by the IRQ line */
+static void uart_service() {
+    UartPolls++;
+    iomux_service();
+}
+
+struct UartRun {
+    uint64_t us     = 0;
+    uint32_t polls  = 0;
+    uint32_t frames = 0;
+    uint64_t bus    = 0;
+    bool     ok     = false;
+};
+
+/* moves `data` over the line one way, with the scheduler running every `step` microseconds */
+static UartRun uart_run(HostSc16is7xx &chip, const std::string &data, bool rx, uint32_t step) {
+    byte        buf[IOMUX_UART_RX_RING];
+    size_t      sent   = 0;
+    std::string got;
+    UartRun     ret;
+    auto        before = iomux_stats();
+    auto        lost   = chip.channel(0).overruns;
+
+    /* the far end sends it all at once, or the sketch writes what the ring takes */
+    UartPolls = 0;
+    host_spi_reset_stats();
+    chip.received(0).clear();
+    if (rx) {
+        chip.send(0, data.data(), data.size());
+    }
+
+    /* until it is all through, or twice the time the line needs */
+    uint64_t limit = data.size() * 2 * 10 * 1000000ull / 9600;
+    while (ret.us < limit) {
+        if (!rx) {
+            sent += iomux_uart_write(reinterpret_cast<const byte *>(&data[sent]), data.size() - sent);
+        }
+
+        /* the line moves on, then the tasks run */
+        chip.advance(step);
+        ret.us += step;
+        sched_run();
+
+        /* the sketch reads whatever arrived */
+        if (rx) {
+            got.append(reinterpret_cast<char *>(buf), iomux_uart_read(buf, sizeof(buf)));
+        }
+
+        /* all of it made it */
+        if ((rx ? got : chip.received(0)).size() == data.size()) {
+            break;
+        }
+    }
+
+    /* the data is intact, and nothing overran the FIFO */
+    ret.ok = (rx ? got : chip.received(0)) == data && chip.channel(0).overruns == lost;
+    ret.polls = UartPolls;
+    ret.frames = iomux_stats().frames - before.frames;
+    ret.bus = host_spi_stats().ns;
+    return ret;
+}
+
+static bool bench_uart(const Options &opts) {
+    static int    task = sched_event("uart", 0, uart_service);
+    HostSc16is7xx chip(15, 4);
+    std::string   data(opts.quick ? 4000 : 65000, 0);
+    uint32_t      step = 100;
+
+    /* a pattern that shows reordering and loss */
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 7 + i / 251);
+    }
+
+    /* the expander with its IRQ line on the service task */
+    iomux_init();
+    if (!iomux_attach(task, nullptr)) {
+        fprintf(stderr, "uart: cannot attach the IRQ line\n");
+        return false;
+    }
+
+    /* the tasks run every `step` microseconds, which bounds how fast the FIFOs are served */
+    printf("uart: %zu bytes each way, tasks every %u us\n", data.size(), step);
+    printf("  baud     dir   KB/s  line%%  polls/byte  frames/byte  bus us/KB\n");
+    for (uint32_t baud : { 115200, 460800, 921600 }) {
+        iomux_uart_begin(baud);
+        for (bool rx : { true, false }) {
+            auto run  = uart_run(chip, data, rx, step);
+            auto rate = data.size() * 1e6 / run.us;
+            printf(
+                "  %-8u %-3s %6.1f %6.1f %11.3f %12.3f %10.1f\n",
+                baud,
+                rx ? "rx" : "tx",
+                rate / 1024,
+                rate * 10 * 100 / baud,
+                1.0 * run.polls / data.size(),
+                1.0 * run.frames / data.size(),
+                run.bus / 1e3 / (data.size() / 1024.0)
+            );
+
+            /* lost or reordered bytes fail the bench */
+            if (!run.ok) {
+                fprintf(stderr, "uart: %s at %u baud lost data\n", rx ? "rx" : "tx", baud);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static const Section Sections[] = {
+    { "http"  , bench_http  },
+    { "iomux" , bench_iomux },
+    { "json"  , bench_json  },
+    { "parse" , bench_parse },
+    { "route" , bench_route },
+    { "uart"  , bench_uart  },
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--quick] [--clients N] [--requests N] [--pipeline N] [--close] [--mix NAME] [SECTION ...]\n", name);
+    fprintf(stderr, "sections:");
+    for (const auto &v : Sections) {
+        fprintf(stderr, " %s", v.name);
+    }
+    fprintf(stderr, "\nmixes:");
+    for (const auto &v : Mixes) {
+        fprintf(stderr, " %s", v.name);
+    }
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bool                      ok = true;
+    Options                   opts;
+    std::vector<std::string>  names;
+
+    /* parse the options */
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            opts.quick = true;
+            opts.requests = 600;
+        } else if (arg == "--close") {
+            opts.close = true;
+        } else if (arg == "--clients" && i + 1 < argc) {
+            opts.clients = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--requests" && i + 1 < argc) {
+            opts.requests = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--pipeline" && i + 1 < argc) {
+            opts.pipeline = std::max<size_t>(strtoul(argv[++i], nullptr, 10), 1);
+        } else if (arg == "--mix" && i + 1 < argc) {
+            opts.mix = argv[++i];
+        } else if (arg[0] == '-') {
+            usage(argv[0]);
+        } else {
+            names.push_back(arg);
+        }
+    }
+
+    /* run the selected sections, or all of them */
+    for (const auto &v : Sections) {
+        if (names.empty() || std::find(names.begin(), names.end(), v.name) != names.end()) {
+            ok &= v.run(opts);
+        }
+    }
+
+    /* fails on errors, so that the quick run works as a smoke test */
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "client.h"
+#include "picohttpparser.h"
+
+std::string HostReply::header(const char *name) const {
+    for (const auto &hdr : headers) {
+        if (!strcasecmp(hdr.first.c_str(), name)) {
+            return hdr.second;
+        }
+    }
+    return std::string();
+}
+
+bool HostClient::connect(uint16_t port, int rcvbuf) {
+    int         on   = 1;
+    sockaddr_in addr = {};
+
+    /* the receive buffer must be set before the window is advertised */
+    close();
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf != 0) {
+        setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    /* the loopback handshake completes in the kernel, the server accepts later */
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close();
+        return false;
+    }
+
+    /* requests go out right away */
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+void HostClient::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+
+    /* ready to connect again */
+    _fd = -1;
+    _err = 0;
+    _eof = false;
+    _in.clear();
+}
+
+bool HostClient::reset() const {
+    return _eof && _err == ECONNRESET;
+}
+
+size_t HostClient::write(std::string_view data) {
+    ssize_t ret = _fd < 0 ? -1 : ::send(_fd, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    return ret < 0 ? 0 : ret;
+}
+
+bool HostClient::send(std::string_view data, const std::function<void()> &idle) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+    /* the server has to read for the rest to go out */
+    while (!data.empty()) {
+        if (_fd < 0 || std::chrono::steady_clock::now() >= end) {
+            return false;
+        }
+
+        /* send as much as possible */
+        data.remove_prefix(write(data));
+        if (!data.empty()) {
+            idle();
+        }
+    }
+
+    /* all sent */
+    return true;
+}
+
+bool HostClient::pump(size_t max) {
+    char    buf[4096];
+    ssize_t ret;
+    size_t  old = _in.size();
+
+    /* nothing more will come */
+    if (_fd < 0 || _eof) {
+        return false;
+    }
+
+    /* read everything that arrived, up to the limit */
+    while (max != 0 && (ret = recv(_fd, buf, std::min(sizeof(buf), max), MSG_DONTWAIT)) > 0) {
+        _in.append(buf, ret);
+        max -= ret;
+    }
+
+    /* stopped by the limit, the rest is left in the socket */
+    if (max == 0) {
+        return _in.size() != old;
+    }
+
+    /* check for EOF and errors */
+    if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        _err = ret == 0 ? 0 : errno;
+        _eof = true;
+    }
+
+    /* whether anything new arrived */
+    return _in.size() != old;
+}
+
+bool HostClient::take(HostReply &reply) {
+    int         minor;
+    int         status;
+    const char *msg;
+    size_t      msg_len;
+    phr_header  hdrs[32];
+    size_t      nhdrs   = 32;
+    size_t      length  = SIZE_MAX;
+    bool        chunked = false;
+
+    /* the status line and headers */
+    int ret = phr_parse_response(_in.data(), _in.size(), &minor, &status, &msg, &msg_len, hdrs, &nhdrs, 0);
+    if (ret <= 0) {
+        return false;
+    }
+
+    /* the headers that frame the body */
+    reply.status = status;
+    reply.headers.clear();
+    for (size_t i = 0; i < nhdrs; i++) {
+        std::string name(hdrs[i].name, hdrs[i].name_len);
+        std::string value(hdrs[i].value, hdrs[i].value_len);
+
+        /* check for the length */
+        if (!strcasecmp(name.c_str(), "content-length")) {
+            length = strtoul(value.c_str(), nullptr, 10);
+        } else if (!strcasecmp(name.c_str(), "transfer-encoding")) {
+            chunked = !strcasecmp(value.c_str(), "chunked");
+        }
+
+        /* keep the header */
+        reply.headers.emplace_back(std::move(name), std::move(value));
+    }
+
+    /* no body at all */
+    if (status / 100 == 1 || status == 204 || status == 304) {
+        length = 0;
+    }
+
+    /* decode a copy, so that an incomplete body can be decoded again later */
+    if (chunked) {
+        std::string         buf = _in.substr(ret);
+        size_t              len = buf.size();
+        phr_chunked_decoder dec = {};
+
+        /* the trailer is part of the reply */
+        dec.consume_trailer = 1;
+        auto rem = phr_decode_chunked(&dec, &buf[0], &len);
+
+        /* incomplete, or malformed */
+        if (rem < 0) {
+            return false;
+        }
+
+        /* the pipelined bytes stay */
+        reply.body = buf.substr(0, len);
+        _in.erase(0, _in.size() - rem);
+        return true;
+    }
+
+    /* read till the end of connection */
+    if (length == SIZE_MAX) {
+        if (!_eof) {
+            return false;
+        } else {
+            reply.body = _in.substr(ret);
+            _in.clear();
+            return true;
+        }
+    }
+
+    /* wait for the whole body */
+    if (_in.size() < ret + length) {
+        return false;
+    }
+
+    /* take the reply */
+    reply.body = _in.substr(ret, length);
+    _in.erase(0, ret + length);
+    return true;
+}
+
+bool HostClient::wait(HostReply &reply, const std::function<void()> &idle, uint32_t timeout) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    /* keep the server running until the reply is complete */
+    for (;;) {
+        pump();
+
+        /* got a reply */
+        if (take(reply)) {
+            return true;
+        }
+
+        /* out of time, or nothing more will come */
+        if (_eof || std::chrono::steady_clock::now() >= end) {
+            return false;
+        }
+
+        /* run the server */
+        idle();
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef __HOST_CLIENT_H__
+#define __HOST_CLIENT_H__
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <string_view>
+
+struct HostReply {
+    int                                              status = 0;
+    std::string                                      body;
+    std::vector<std::pair<std::string, std::string>> headers;
+
+public:
+    /* empty if absent */
+    std::string header(const char *name) const;
+};
+
+/* a non-blocking HTTP/1.1 client on the loopback interface, `idle` runs the server while waiting */
+class HostClient {
+    int         _fd  = -1;
+    int         _err = 0;
+    bool        _eof = false;
+    std::string _in;
+
+public:
+    HostClient() = default;
+    ~HostClient() { close(); }
+
+public:
+    HostClient(const HostClient &)            = delete;
+    HostClient &operator=(const HostClient &) = delete;
+
+public:
+    /* a small `rcvbuf` makes a slow reader, the window closes once it is full */
+    bool connect(uint16_t port, int rcvbuf = 0);
+    void close();
+
+public:
+    /* true once the peer closed, `reset` tells an RST from a FIN */
+    bool connected() const { return _fd >= 0 && !_eof; }
+    bool closed()    const { return _eof; }
+    bool reset()  const;
+
+public:
+    /* what arrived and was not taken as a reply yet */
+    std::string &raw() { return _in; }
+
+public:
+    /* write() sends what the socket takes, send() all of it */
+    size_t write(std::string_view data);
+    bool   send(std::string_view data, const std::function<void()> &idle);
+
+public:
+    /* reads whatever arrived, at most `max` bytes, false if nothing did */
+    bool pump(size_t max = SIZE_MAX);
+
+public:
+    /* takes one complete reply off the received bytes, wait() pumps until one is there */
+    bool take(HostReply &reply);
+    bool wait(HostReply &reply, const std::function<void()> &idle, uint32_t timeout = 2000);
+};
+
+#endif
@@ -0,0 +1,8 @@
+#include "../feel-better-soon.ino"
+
+int main() {
+    setup();
+    for (;;) {
+        loop();
+    }
+}
@@ -0,0 +1,183 @@
+#include <string.h>
+#include <bearssl/bearssl_hash.h>
+
+#define ROL(x, n)   (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t load_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void sha1_block(uint32_t *val, const uint8_t *buf) {
+    uint32_t w[80];
+    uint32_t a = val[0], b = val[1], c = val[2], d = val[3], e = val[4];
+
+    /* message schedule */
+    for (int i = 0; i < 16; i++) {
+        w[i] = load_be32(&buf[i * 4]);
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    /* 80 rounds */
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    /* add to the state */
+    val[0] += a;
+    val[1] += b;
+    val[2] += c;
+    val[3] += d;
+    val[4] += e;
+}
+
+static void sha256_block(uint32_t *val, const uint8_t *buf) {
+    uint32_t w[64];
+    uint32_t s[8];
+
+    /* message schedule */
+    for (int i = 0; i < 16; i++) {
+        w[i] = load_be32(&buf[i * 4]);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    /* 64 rounds */
+    memcpy(s, val, sizeof(s));
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + K256[i] + w[i];
+        uint32_t t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(&s[1], &s[0], sizeof(s[0]) * 7);
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    /* add to the state */
+    for (int i = 0; i < 8; i++) {
+        val[i] += s[i];
+    }
+}
+
+/* both hashes share the Merkle-Damgard padding with a big-endian bit count */
+static void md_update(uint8_t *buf, uint64_t *count, uint32_t *val, void (*block)(uint32_t *, const uint8_t *), const void *data, size_t len) {
+    const uint8_t *p = data;
+
+    /* fill the block buffer, and hash it once full */
+    while (len != 0) {
+        size_t pos = *count & 63;
+        size_t rem = 64 - pos < len ? 64 - pos : len;
+        memcpy(&buf[pos], p, rem);
+        *count += rem;
+        p += rem;
+        len -= rem;
+
+        /* a whole block */
+        if ((*count & 63) == 0) {
+            block(val, buf);
+        }
+    }
+}
+
+static void md_final(const uint8_t *buf, uint64_t count, uint32_t *val, size_t words, void (*block)(uint32_t *, const uint8_t *), uint8_t *out) {
+    uint8_t  tmp[64];
+    size_t   pos = count & 63;
+    uint64_t len = count * 8;
+
+    /* the 0x80 marker */
+    memcpy(tmp, buf, pos);
+    tmp[pos++] = 0x80;
+
+    /* no room for the length */
+    if (pos > 56) {
+        memset(&tmp[pos], 0, 64 - pos);
+        block(val, tmp);
+        pos = 0;
+    }
+
+    /* the length in bits */
+    memset(&tmp[pos], 0, 56 - pos);
+    store_be32(&tmp[56], len >> 32);
+    store_be32(&tmp[60], len);
+    block(val, tmp);
+
+    /* the digest */
+    for (size_t i = 0; i < words; i++) {
+        store_be32(&out[i * 4], val[i]);
+    }
+}
+
+void br_sha1_init(br_sha1_context *ctx) {
+    static const uint32_t iv[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    memcpy(ctx->val, iv, sizeof(iv));
+    ctx->count = 0;
+}
+
+void br_sha1_update(br_sha1_context *ctx, const void *data, size_t len) {
+    md_update(ctx->buf, &ctx->count, ctx->val, sha1_block, data, len);
+}
+
+void br_sha1_out(const br_sha1_context *ctx, void *out) {
+    uint32_t val[5];
+    memcpy(val, ctx->val, sizeof(val));
+    md_final(ctx->buf, ctx->count, val, 5, sha1_block, out);
+}
+
+void br_sha256_init(br_sha256_context *ctx) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->val, iv, sizeof(iv));
+    ctx->count = 0;
+}
+
+void br_sha256_update(br_sha256_context *ctx, const void *data, size_t len) {
+    md_update(ctx->buf, &ctx->count, ctx->val, sha256_block, data, len);
+}
+
+void br_sha256_out(const br_sha256_context *ctx, void *out) {
+    uint32_t val[8];
+    memcpy(val, ctx->val, sizeof(val));
+    md_final(ctx->buf, ctx->count, val, 8, sha256_block, out);
+}
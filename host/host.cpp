@@ -0,0 +1,556 @@
+#include <new>
+#include <set>
+#include <chrono>
+#include <string>
+
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <SPI.h>
+#include <Updater.h>
+#include <LittleFS.h>
+#include <ESP8266WiFi.h>
+
+#include "host.h"
+
+#define HOST_PINS           17
+#define HOST_SKETCH_SPACE   (1024 * 1024)
+
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__real_calloc(size_t num, size_t size);
+extern "C" void *__real_realloc(void *ptr, size_t size);
+
+struct HostIrq {
+    void (*fn)(void *);
+    void * arg;
+    int    mode;
+};
+
+static auto                  _epoch    = std::chrono::steady_clock::now();
+static uint64_t              _skew     = 0;
+static uint32_t              _restarts = 0;
+static thread_local uint64_t _allocs   = 0;
+
+static uint8_t         _level[HOST_PINS]  = {};
+static bool            _driven[HOST_PINS] = {};
+static HostIrq         _irqs[HOST_PINS]   = {};
+static HostSpiDevice * _devs[HOST_PINS]   = {};
+static HostSpiStats    _spi               = {};
+static uint32_t        _spi_freq          = 1000000;
+
+EspClass         ESP;
+HardwareSerial   Serial;
+HostGpioReg      GPOS = { HIGH };
+HostGpioReg      GPOC = { LOW };
+SPIClass         SPI;
+UpdaterClass     Update;
+ESP8266WiFiClass WiFi;
+fs::FS           LittleFS(getenv("LITTLEFS_ROOT") ? getenv("LITTLEFS_ROOT") : "data");
+
+static uint64_t host_micros() {
+    auto now = std::chrono::steady_clock::now() - _epoch;
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count() + _skew;
+}
+
+unsigned long millis() {
+    return static_cast<uint32_t>(host_micros() / 1000);
+}
+
+unsigned long micros() {
+    return static_cast<uint32_t>(host_micros());
+}
+
+void delay(unsigned long ms) {
+    _skew += static_cast<uint64_t>(ms) * 1000;
+}
+
+void host_advance(uint32_t ms) {
+    _skew += static_cast<uint64_t>(ms) * 1000;
+}
+
+extern "C" void *__wrap_malloc(size_t size) {
+    _allocs++;
+    return __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t num, size_t size) {
+    _allocs++;
+    return __real_calloc(num, size);
+}
+
+extern "C" void *__wrap_realloc(void *ptr, size_t size) {
+    _allocs++;
+    return __real_realloc(ptr, size);
+}
+
+void *operator new(size_t size) {
+    if (void *ptr = malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    } else {
+        throw std::bad_alloc();
+    }
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+uint64_t host_allocs() {
+    return _allocs;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < HOST_PINS && mode == INPUT_PULLUP && !_driven[pin]) {
+        _level[pin] = HIGH;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < HOST_PINS ? _level[pin] : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin >= HOST_PINS || _level[pin] == !!val) {
+        return;
+    }
+
+    /* CS edges select and release the SPI devices */
+    _level[pin] = !!val;
+    if (_devs[pin] != nullptr) {
+        if (val) {
+            _devs[pin]->deselect();
+        } else {
+            _devs[pin]->select();
+            _spi.frames++;
+        }
+    }
+}
+
+void attachInterruptArg(uint8_t pin, void (*fn)(void *), void *arg, int mode) {
+    if (pin < HOST_PINS) {
+        _irqs[pin] = HostIrq { fn, arg, mode };
+    }
+}
+
+void HostGpioReg::operator=(uint32_t mask) {
+    for (uint8_t pin = 0; pin < 16; pin++) {
+        if (mask & (1u << pin)) {
+            digitalWrite(pin, level);
+        }
+    }
+}
+
+void host_gpio_input(uint8_t pin, bool level) {
+    auto &irq = _irqs[pin];
+    bool  old = _level[pin];
+
+    /* the pin is no longer pulled up */
+    _level[pin] = level;
+    _driven[pin] = true;
+
+    /* check for edges */
+    if (irq.fn == nullptr || old == level) {
+        return;
+    }
+
+    /* fire the interrupt on matching edges */
+    if (irq.mode == CHANGE || irq.mode == (level ? RISING : FALLING)) {
+        irq.fn(irq.arg);
+    }
+}
+
+void SPIClass::setFrequency(uint32_t freq) {
+    _spi_freq = freq;
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    uint8_t ret = 0xff;
+
+    /* every selected device sees the byte */
+    for (uint8_t pin = 0; pin < HOST_PINS; pin++) {
+        if (_devs[pin] != nullptr && _level[pin] == LOW) {
+            ret = _devs[pin]->transfer(data);
+        }
+    }
+
+    /* 8 clocks per byte */
+    _spi.bytes++;
+    _spi.ns += 8000000000ull / _spi_freq;
+    return ret;
+}
+
+uint16_t SPIClass::transfer16(uint16_t data) {
+    uint8_t hi = transfer(data >> 8);
+    uint8_t lo = transfer(data & 0xff);
+    return (hi << 8) | lo;
+}
+
+void SPIClass::transferBytes(const uint8_t *out, uint8_t *in, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t ret = transfer(out == nullptr ? 0xff : out[i]);
+        if (in != nullptr) {
+            in[i] = ret;
+        }
+    }
+}
+
+void SPIClass::writeBytes(const uint8_t *data, uint32_t size) {
+    transferBytes(data, nullptr, size);
+}
+
+void host_spi_attach(uint8_t cs, HostSpiDevice *dev) {
+    _devs[cs] = dev;
+    _level[cs] = HIGH;
+}
+
+void host_spi_reset_stats() {
+    _spi = {};
+}
+
+const HostSpiStats &host_spi_stats() {
+    return _spi;
+}
+
+size_t Print::printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(nullptr, 0, fmt, args);
+    va_end(args);
+
+    /* format the whole string */
+    std::string buf(len, 0);
+    va_start(args, fmt);
+    vsnprintf(&buf[0], len + 1, fmt, args);
+    va_end(args);
+    return write(buf.data(), buf.size());
+}
+
+void HardwareSerial::flush() {
+    fflush(stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+    return fwrite(buf, 1, len, stdout);
+}
+
+uint32_t EspClass::getCycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+    return static_cast<uint32_t>(__rdtsc());
+#else
+    auto now = std::chrono::steady_clock::now() - _epoch;
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+#endif
+}
+
+uint32_t EspClass::getFreeHeap() {
+    return 0;
+}
+
+void EspClass::restart() {
+    _restarts++;
+}
+
+uint32_t host_restarts() {
+    return _restarts;
+}
+
+struct WiFiClient::Socket {
+    int fd;
+
+public:
+    /* never destroyed, static servers and clients are torn down after it would be */
+    static std::set<Socket *> &open() {
+        static auto *ret = new std::set<Socket *>;
+        return *ret;
+    }
+
+public:
+    explicit Socket(int fd) : fd(fd) { open().insert(this); }
+    ~Socket() { close(); open().erase(this); }
+
+public:
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+WiFiClient::WiFiClient(int fd) : _sock(std::make_shared<Socket>(fd)) {}
+
+uint8_t WiFiClient::connected() {
+    char ch;
+    int  ret;
+
+    /* never connected, or closed by us */
+    if (_sock == nullptr || _sock->fd < 0) {
+        return 0;
+    }
+
+    /* the peer is gone once its FIN is all that is left */
+    ret = recv(_sock->fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret > 0 || (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+int WiFiClient::available() {
+    int nb = 0;
+    if (_sock == nullptr || _sock->fd < 0 || ioctl(_sock->fd, FIONREAD, &nb) < 0) {
+        return 0;
+    } else {
+        return nb;
+    }
+}
+
+size_t WiFiClient::availableForWrite() {
+    int       out = 0;
+    int       buf = 0;
+    socklen_t len = sizeof(buf);
+
+    /* the free space in the send buffer */
+    if (_sock == nullptr || _sock->fd < 0) {
+        return 0;
+    } else if (getsockopt(_sock->fd, SOL_SOCKET, SO_SNDBUF, &buf, &len) < 0 || ioctl(_sock->fd, SIOCOUTQ, &out) < 0) {
+        return 0;
+    } else {
+        return buf > out ? buf - out : 0;
+    }
+}
+
+int WiFiClient::read(uint8_t *buf, size_t len) {
+    if (_sock == nullptr || _sock->fd < 0 || len == 0) {
+        return 0;
+    } else {
+        return std::max<ssize_t>(recv(_sock->fd, buf, len, MSG_DONTWAIT), 0);
+    }
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t len) {
+    if (_sock == nullptr || _sock->fd < 0 || len == 0) {
+        return 0;
+    } else {
+        return std::max<ssize_t>(send(_sock->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL), 0);
+    }
+}
+
+void WiFiClient::keepAlive(uint16_t idle, uint16_t intv, uint8_t count) {
+    int on  = 1;
+    int val = count;
+
+    /* same probes as lwIP */
+    if (_sock != nullptr && _sock->fd >= 0) {
+        setsockopt(_sock->fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        setsockopt(_sock->fd, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val));
+        setsockopt(_sock->fd, IPPROTO_TCP, TCP_KEEPIDLE, &(val = idle), sizeof(val));
+        setsockopt(_sock->fd, IPPROTO_TCP, TCP_KEEPINTVL, &(val = intv), sizeof(val));
+    }
+}
+
+void WiFiClient::stop() {
+    if (_sock != nullptr) {
+        _sock->close();
+    }
+}
+
+void WiFiClient::abort() {
+    linger lg = { 1, 0 };
+
+    /* a zero linger time resets the connection */
+    if (_sock != nullptr && _sock->fd >= 0) {
+        setsockopt(_sock->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        _sock->close();
+    }
+}
+
+void WiFiClient::stopAll() {
+    for (auto sock : Socket::open()) {
+        sock->close();
+    }
+}
+
+void WiFiServer::begin() {
+    int         on   = 1;
+    sockaddr_in addr = {};
+    socklen_t   len  = sizeof(addr);
+
+    /* listen on every interface */
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_port);
+    _fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    /* a server that can not start does not accept anything, like on the device */
+    if (bind(_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(_fd, 16) < 0) {
+        perror("WiFiServer::begin()");
+        close();
+        return;
+    }
+
+    /* find out the ephemeral port */
+    getsockname(_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+    _port = ntohs(addr.sin_port);
+}
+
+void WiFiServer::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+WiFiClient WiFiServer::available() {
+    int on  = 1;
+    int buf = HOST_TCP_SND_BUF;
+    int fd  = _fd < 0 ? -1 : accept4(_fd, nullptr, nullptr, SOCK_NONBLOCK);
+
+    /* no pending connections */
+    if (fd < 0) {
+        return WiFiClient();
+    }
+
+    /* same send buffer as lwIP */
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+
+    /* Nagle's algorithm is on by default */
+    if (!_delay) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    /* wrap the socket */
+    return WiFiClient(fd);
+}
+
+uint16_t host_free_port() {
+    sockaddr_in addr = {};
+    socklen_t   len  = sizeof(addr);
+    int         fd   = socket(AF_INET, SOCK_STREAM, 0);
+
+    /* let the kernel pick one */
+    addr.sin_family = AF_INET;
+    bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+struct fs::File::Handle {
+    FILE *      fp;
+    bool        dir;
+    size_t      size;
+    std::string name;
+
+public:
+    ~Handle() {
+        if (fp != nullptr) {
+            fclose(fp);
+        }
+    }
+};
+
+size_t fs::File::size() const {
+    return _h == nullptr ? 0 : _h->size;
+}
+
+const char *fs::File::name() const {
+    return _h == nullptr ? "" : _h->name.c_str();
+}
+
+bool fs::File::isDirectory() const {
+    return _h != nullptr && _h->dir;
+}
+
+bool fs::File::seek(uint32_t pos) {
+    return _h != nullptr && _h->fp != nullptr && pos <= _h->size && fseek(_h->fp, pos, SEEK_SET) == 0;
+}
+
+int fs::File::read(uint8_t *buf, size_t len) {
+    return _h == nullptr || _h->fp == nullptr ? 0 : fread(buf, 1, len, _h->fp);
+}
+
+bool fs::FS::begin() {
+    struct stat st;
+    return stat(_root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+fs::File fs::FS::open(const char *path, const char *mode) {
+    File        ret;
+    struct stat st;
+    std::string name = _root + path;
+
+    /* only reading is needed so far */
+    if (strcmp(mode, "r") != 0 || stat(name.c_str(), &st) != 0) {
+        return ret;
+    }
+
+    /* LittleFS reports the name without the directories */
+    ret._h = std::make_shared<File::Handle>();
+    ret._h->dir = S_ISDIR(st.st_mode);
+    ret._h->size = st.st_size;
+    ret._h->name = name.substr(name.rfind('/') + 1);
+
+    /* directories have no contents */
+    if (!ret._h->dir && (ret._h->fp = fopen(name.c_str(), "rb")) == nullptr) {
+        ret._h = nullptr;
+    }
+
+    /* opened successfully */
+    return ret;
+}
+
+bool UpdaterClass::begin(size_t size, int command) {
+    if (_running || size == 0 || size > HOST_SKETCH_SPACE) {
+        return false;
+    }
+
+    /* start a new image */
+    _size = size;
+    _running = true;
+    _image.clear();
+    return true;
+}
+
+size_t UpdaterClass::write(uint8_t *data, size_t len) {
+    if (!_running || _image.size() + len > _size) {
+        return 0;
+    } else {
+        _image.insert(_image.end(), data, data + len);
+        return len;
+    }
+}
+
+bool UpdaterClass::end(bool evenIfRemaining) {
+    if (!_running) {
+        return false;
+    }
+
+    /* an incomplete image is discarded */
+    _running = false;
+    return _image.size() == _size || evenIfRemaining;
+}
@@ -0,0 +1,52 @@
+#ifndef __HOST_H__
+#define __HOST_H__
+
+#include <Arduino.h>
+
+/* moves millis() and micros() forward without sleeping */
+void host_advance(uint32_t ms);
+
+/* heap allocations made by the calling thread so far, malloc() and operator new alike */
+uint64_t host_allocs();
+
+/* an unused TCP port on the loopback interface, for servers under test */
+uint16_t host_free_port();
+
+/* number of ESP.restart() calls */
+uint32_t host_restarts();
+
+/* drives an input pin like a device on the board would, the attached interrupt fires on a matching edge */
+void host_gpio_input(uint8_t pin, bool level);
+
+/* a device on the SPI bus, selected while its CS pin is low */
+class HostSpiDevice {
+public:
+    virtual ~HostSpiDevice() = default;
+
+public:
+    virtual void    select()   {}
+    virtual void    deselect() {}
+    virtual uint8_t transfer(uint8_t data) = 0;
+};
+
+/* bus time is derived from the programmed clock, a frame is one CS assertion */
+struct HostSpiStats {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t ns;
+};
+
+void                host_spi_attach(uint8_t cs, HostSpiDevice *dev);
+void                host_spi_reset_stats();
+const HostSpiStats &host_spi_stats();
+
+/* fails the test with the location of the check */
+#define CHECK(cond)                                                                         \
+    do {                                                                                    \
+        if (!(cond)) {                                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);       \
+            exit(1);                                                                        \
+        }                                                                                   \
+    } while (0)
+
+#endif
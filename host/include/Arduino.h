@@ -0,0 +1,97 @@
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+/* the subset of the ESP8266 Arduino core used by the firmware, backed by the host */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <sys/pgmspace.h>
+
+#define IRAM_ATTR
+#define LED_BUILTIN     2
+
+#define LOW             0x0
+#define HIGH            0x1
+
+#define INPUT           0x00
+#define OUTPUT          0x01
+#define INPUT_PULLUP    0x02
+
+#define RISING          0x01
+#define FALLING         0x02
+#define CHANGE          0x03
+
+typedef uint8_t byte;
+
+/* the clock starts at zero and wraps like the device one, delay() moves it without sleeping */
+unsigned long millis();
+unsigned long micros();
+void          delay(unsigned long ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int  digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+void attachInterruptArg(uint8_t pin, void (*fn)(void *), void *arg, int mode);
+
+static inline int digitalPinToInterrupt(uint8_t pin) {
+    return pin;
+}
+
+/* GPIO output set / clear registers, writes go through digitalWrite() */
+struct HostGpioReg {
+    uint8_t level;
+    void    operator=(uint32_t mask);
+};
+
+extern HostGpioReg GPOS;
+extern HostGpioReg GPOC;
+
+class Print {
+public:
+    virtual ~Print() = default;
+
+public:
+    virtual size_t write(uint8_t ch) { return write(&ch, 1); }
+    virtual size_t write(const uint8_t *buf, size_t len) = 0;
+
+public:
+    size_t write(const char *buf, size_t len) { return write(reinterpret_cast<const uint8_t *>(buf), len); }
+    size_t print(const char *str)             { return write(str, strlen(str)); }
+    size_t println(const char *str = "")      { return print(str) + print("\r\n"); }
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+/* goes to stdout */
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long) {}
+    void flush();
+
+public:
+    using Print::write;
+    size_t write(const uint8_t *buf, size_t len) override;
+};
+
+/* the cycle counter runs at the host clock, the heap is not tracked */
+class EspClass {
+public:
+    uint32_t getCycleCount();
+    uint32_t getFreeHeap();
+    void     restart();
+};
+
+extern EspClass       ESP;
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef __HOST_ESP8266WIFI_H__
+#define __HOST_ESP8266WIFI_H__
+
+/* POSIX sockets behind the ESP8266WiFi classes, always non-blocking like lwIP */
+
+#include <Arduino.h>
+
+enum wl_status_t {
+    WL_NO_SHIELD        = 255,
+    WL_IDLE_STATUS      = 0,
+    WL_NO_SSID_AVAIL    = 1,
+    WL_SCAN_COMPLETED   = 2,
+    WL_CONNECTED        = 3,
+    WL_CONNECT_FAILED   = 4,
+    WL_CONNECTION_LOST  = 5,
+    WL_WRONG_PASSWORD   = 6,
+    WL_DISCONNECTED     = 7,
+};
+
+/* the send buffer of the accepted sockets, lwIP gives the ESP8266 2 * TCP_MSS */
+#define HOST_TCP_SND_BUF    2920
+
+class WiFiClient : public Print {
+    struct Socket;
+
+private:
+    std::shared_ptr<Socket> _sock;
+
+public:
+    WiFiClient() = default;
+    explicit WiFiClient(int fd);
+
+public:
+    uint8_t connected();
+    int     available();
+    size_t  availableForWrite();
+
+public:
+    int read(uint8_t *buf, size_t len);
+    int read(char *buf, size_t len) { return read(reinterpret_cast<uint8_t *>(buf), len); }
+
+public:
+    using Print::write;
+    size_t write(const uint8_t *buf, size_t len) override;
+    size_t write_P(const char *buf, size_t len) { return write(buf, len); }
+
+public:
+    void keepAlive(uint16_t idle, uint16_t intv, uint8_t count);
+    void stop();
+    void abort();
+
+public:
+    static void stopAll();
+};
+
+class WiFiServer {
+    int      _fd    = -1;
+    bool     _delay = true;
+    uint16_t _port;
+
+public:
+    explicit WiFiServer(uint16_t port) : _port(port) {}
+    ~WiFiServer() { close(); }
+
+public:
+    /* port 0 binds an ephemeral port, which port() reports after begin() */
+    uint16_t   port() const { return _port; }
+    WiFiClient available();
+
+public:
+    void begin();
+    void close();
+    void setNoDelay(bool nodelay) { _delay = !nodelay; }
+};
+
+/* the station is connected as soon as it is started */
+class ESP8266WiFiClass {
+    wl_status_t _status = WL_DISCONNECTED;
+
+public:
+    wl_status_t status() const { return _status; }
+
+public:
+    void begin(const char *, const char *) { _status = WL_CONNECTED; }
+    void setAutoReconnect(bool)            {}
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __HOST_FS_H__
+#define __HOST_FS_H__
+
+/* a directory of the host filesystem standing in for the flash partition */
+
+#include <string>
+#include <Arduino.h>
+
+namespace fs {
+
+class File {
+    friend class FS;
+
+private:
+    struct Handle;
+    std::shared_ptr<Handle> _h;
+
+public:
+    explicit operator bool() const { return _h != nullptr; }
+
+public:
+    size_t      size() const;
+    const char *name() const;
+    bool        isDirectory() const;
+
+public:
+    bool seek(uint32_t pos);
+    int  read(uint8_t *buf, size_t len);
+    void close() { _h = nullptr; }
+};
+
+class FS {
+    std::string _root;
+
+public:
+    explicit FS(std::string root) : _root(std::move(root)) {}
+
+public:
+    bool begin();
+    File open(const char *path, const char *mode);
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+
+#endif
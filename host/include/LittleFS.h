@@ -0,0 +1,9 @@
+#ifndef __HOST_LITTLEFS_H__
+#define __HOST_LITTLEFS_H__
+
+#include <FS.h>
+
+/* rooted at $LITTLEFS_ROOT, or the sketch's "data" directory used for uploads */
+extern fs::FS LittleFS;
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __HOST_SPI_H__
+#define __HOST_SPI_H__
+
+/* the SPI master, each byte goes to the device whose CS pin is low, a bus with nothing on it reads 0xff */
+
+#include <Arduino.h>
+
+class SPIClass {
+public:
+    void begin() {}
+    void setFrequency(uint32_t freq);
+
+public:
+    uint8_t  transfer(uint8_t data);
+    uint16_t transfer16(uint16_t data);
+    void     transferBytes(const uint8_t *out, uint8_t *in, uint32_t size);
+    void     writeBytes(const uint8_t *data, uint32_t size);
+};
+
+extern SPIClass SPI;
+
+#endif
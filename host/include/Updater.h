@@ -0,0 +1,26 @@
+#ifndef __HOST_UPDATER_H__
+#define __HOST_UPDATER_H__
+
+/* the update partition is kept in memory */
+
+#include <Arduino.h>
+
+#define U_FLASH 0
+
+class UpdaterClass {
+    bool                 _running = false;
+    size_t               _size    = 0;
+    std::vector<uint8_t> _image;
+
+public:
+    bool   begin(size_t size, int command = U_FLASH);
+    size_t write(uint8_t *data, size_t len);
+    bool   end(bool evenIfRemaining = false);
+
+public:
+    const std::vector<uint8_t> &image() const { return _image; }
+};
+
+extern UpdaterClass Update;
+
+#endif
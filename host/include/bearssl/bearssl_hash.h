@@ -0,0 +1,40 @@
+#ifndef __HOST_BEARSSL_HASH_H__
+#define __HOST_BEARSSL_HASH_H__
+
+/* the two BearSSL hashes used by the firmware */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define br_sha1_SIZE    20
+#define br_sha256_SIZE  32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t  buf[64];
+    uint64_t count;
+    uint32_t val[5];
+} br_sha1_context;
+
+typedef struct {
+    uint8_t  buf[64];
+    uint64_t count;
+    uint32_t val[8];
+} br_sha256_context;
+
+void br_sha1_init(br_sha1_context *ctx);
+void br_sha1_update(br_sha1_context *ctx, const void *data, size_t len);
+void br_sha1_out(const br_sha1_context *ctx, void *out);
+
+void br_sha256_init(br_sha256_context *ctx);
+void br_sha256_update(br_sha256_context *ctx, const void *data, size_t len);
+void br_sha256_out(const br_sha256_context *ctx, void *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __HOST_PGMSPACE_H__
+#define __HOST_PGMSPACE_H__
+
+/* flash is ordinary memory on the host */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define PROGMEM
+#define PSTR(s)                 (s)
+
+#define pgm_read_byte(addr)     (*reinterpret_cast<const uint8_t *>(addr))
+#define pgm_read_word(addr)     (*reinterpret_cast<const uint16_t *>(addr))
+#define pgm_read_dword(addr)    (*reinterpret_cast<const uint32_t *>(addr))
+#define pgm_read_ptr(addr)      (*(void * const *)(addr))
+
+#define memcmp_P                memcmp
+#define memcpy_P                memcpy
+#define strlen_P                strlen
+#define strncmp_P               strncmp
+#define strncpy_P               strncpy
+#define snprintf_P              snprintf
+#define strcasecmp_P            strcasecmp
+#define strncasecmp_P           strncasecmp
+
+#endif
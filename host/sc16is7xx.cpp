@@ -0,0 +1,308 @@
+#include <algorithm>
+
+#include "sc16is7xx.h"
+
+#define XTAL    14745600
+
+HostSc16is7xx::HostSc16is7xx(uint8_t cs, int irq) : _cs(cs), _irq(irq) {
+    host_spi_attach(cs, this);
+    update();
+}
+
+HostSc16is7xx::~HostSc16is7xx() {
+    host_spi_attach(_cs, nullptr);
+}
+
+void HostSc16is7xx::deselect() {
+    if (_pos != 0) {
+        frames++;
+    }
+
+    /* the interrupt sources may have changed */
+    update();
+}
+
+uint8_t HostSc16is7xx::transfer(uint8_t data) {
+    auto &ch  = _ch[(_addr >> 1) & 1];
+    auto  reg = (_addr >> 3) & 0x0f;
+
+    /* the address byte, R/W in bit 7, the register in bits 6:3 and the channel in bits 2:1 */
+    if (_pos++ == 0) {
+        _addr = data;
+        return 0xff;
+    }
+
+    /* the address does not move on, so the FIFOs are read or written a byte at a time within a frame */
+    if (_addr & 0x80) {
+        return read(ch, reg);
+    } else {
+        writes[reg]++;
+        write(ch, reg, data);
+        return 0xff;
+    }
+}
+
+void HostSc16is7xx::advance(uint32_t us) {
+    _now += static_cast<uint64_t>(us) * 1000;
+
+    /* both lines move one byte per character time */
+    for (auto &ch : _ch) {
+        auto ns = byte_ns(ch);
+        if (ns == 0) {
+            continue;
+        }
+
+        /* the RX shifter hands complete bytes to the FIFO, and loses them when it is full */
+        while (!ch.line_in.empty() && ch.rx_next <= _now) {
+            if (ch.rx.size() < HOST_UART_FIFO) {
+                ch.rx.push_back(ch.line_in.front());
+            } else {
+                ch.overruns++;
+                ch.lsr |= 0x02;
+            }
+
+            /* the next byte follows right after */
+            ch.line_in.pop_front();
+            ch.rx_last = ch.rx_next;
+            ch.rx_next += ns;
+        }
+
+        /* the TX shifter takes the bytes off the FIFO at the same rate */
+        while (!ch.tx.empty() && ch.tx_next <= _now) {
+            ch.line_out.push_back(static_cast<char>(ch.tx.front()));
+            ch.tx.pop_front();
+            ch.tx_next += ns;
+        }
+    }
+
+    /* the FIFO levels changed */
+    update();
+}
+
+void HostSc16is7xx::send(int ch, const void *buf, size_t len) {
+    auto &c = _ch[ch];
+    auto  p = static_cast<const byte *>(buf);
+
+    /* an idle line starts with the first byte now */
+    if (c.line_in.empty()) {
+        c.rx_next = _now + byte_ns(c);
+    }
+    c.line_in.insert(c.line_in.end(), p, p + len);
+}
+
+void HostSc16is7xx::input(byte levels) {
+    byte chg = (levels ^ _input) & ~_iodir & _ioint;
+
+    /* a change on an enabled input latches the interrupt until IOSTATE is read */
+    _input = levels;
+    _io_irq |= chg != 0;
+    update();
+}
+
+void HostSc16is7xx::reset() {
+    _iodir = 0;
+    _iodata = 0;
+    _ioint = 0;
+    _ioctrl = 0;
+    _io_irq = false;
+
+    /* both channels back to their defaults, the far ends stay */
+    for (auto &ch : _ch) {
+        Channel def;
+        std::swap(def.line_in, ch.line_in);
+        std::swap(def.line_out, ch.line_out);
+        ch = std::move(def);
+    }
+}
+
+void HostSc16is7xx::update() {
+    bool level = true;
+
+    /* the IRQ output is open-drain and active low, any pending source pulls it down */
+    for (auto &ch : _ch) {
+        level &= !rx_pending(ch) && !tx_pending(ch);
+    }
+    level &= !_io_irq;
+
+    /* drive the pin on changes only, the edge is what fires the interrupt */
+    if (_irq >= 0 && level != _level) {
+        host_gpio_input(_irq, level);
+    }
+    _level = level;
+}
+
+bool HostSc16is7xx::rx_pending(const Channel &ch) const {
+    size_t level = (ch.tlr >> 4) != 0 ? (ch.tlr >> 4) * 4 : 8;
+    auto   ns    = byte_ns(ch);
+
+    /* at the trigger level, or data sitting in the FIFO for 4 character times */
+    if (!(ch.ier & 0x01) || ch.rx.empty()) {
+        return false;
+    } else {
+        return ch.rx.size() >= level || (ns != 0 && _now - ch.rx_last >= 4 * ns);
+    }
+}
+
+bool HostSc16is7xx::tx_pending(const Channel &ch) const {
+    size_t level = (ch.tlr & 0x0f) != 0 ? (ch.tlr & 0x0f) * 4 : 8;
+
+    /* room for at least the trigger level */
+    return (ch.ier & 0x02) && HOST_UART_FIFO - ch.tx.size() >= level;
+}
+
+uint64_t HostSc16is7xx::byte_ns(const Channel &ch) const {
+    uint32_t div = ch.dll | (ch.dlh << 8);
+
+    /* 8N1 is 10 bits a byte, a zero divisor stops the clock */
+    return div == 0 ? 0 : 10ull * 16 * div * 1000000000 / XTAL;
+}
+
+byte HostSc16is7xx::read(Channel &ch, byte reg) {
+    byte ret = 0;
+
+    /* the divisor latch, and the enhanced registers behind LCR = 0xbf */
+    if (ch.lcr == 0xbf) {
+        switch (reg) {
+            case 0x02 : return ch.efr;
+            case 0x04 : return ch.xon[0];
+            case 0x05 : return ch.xon[1];
+            case 0x06 : return ch.xoff[0];
+            case 0x07 : return ch.xoff[1];
+        }
+    } else if (ch.lcr & 0x80) {
+        switch (reg) {
+            case 0x00 : return ch.dll;
+            case 0x01 : return ch.dlh;
+        }
+    }
+
+    /* TCR and TLR take the place of MSR and SPR with MCR[2] set */
+    if ((ch.mcr & 0x04) && (ch.efr & 0x10)) {
+        switch (reg) {
+            case 0x06 : return ch.tcr;
+            case 0x07 : return ch.tlr;
+        }
+    }
+
+    /* the general register set */
+    switch (reg) {
+        case 0x00: {
+            if (!ch.rx.empty()) {
+                ch.rhr = ch.rx.front();
+                ch.rx.pop_front();
+            }
+            return ch.rhr;
+        }
+
+        /* interrupt identification, by priority */
+        case 0x02: {
+            if (rx_pending(ch)) {
+                ret = 0x04;
+            } else if (tx_pending(ch)) {
+                ret = 0x02;
+            } else if (_io_irq) {
+                ret = 0x30;
+            } else {
+                ret = 0x01;
+            }
+            return ret | ((ch.fcr & 0x01) ? 0xc0 : 0x00);
+        }
+
+        /* line status, the overrun is cleared by the read */
+        case 0x05: {
+            ret = ch.lsr | (ch.rx.empty() ? 0x00 : 0x01) | (ch.tx.empty() ? 0x60 : 0x00);
+            ch.lsr &= ~0x02;
+            return ret;
+        }
+
+        /* input pins read their levels, outputs their latch, and the read clears the interrupt */
+        case 0x0b: {
+            _io_irq = false;
+            return (_iodata & _iodir) | (_input & ~_iodir);
+        }
+
+        /* the rest are plain registers */
+        case 0x01 : return ch.ier;
+        case 0x03 : return ch.lcr;
+        case 0x04 : return ch.mcr;
+        case 0x06 : return 0x00;
+        case 0x07 : return ch.spr;
+        case 0x08 : return HOST_UART_FIFO - ch.tx.size();
+        case 0x09 : return ch.rx.size();
+        case 0x0a : return _iodir;
+        case 0x0c : return _ioint;
+        case 0x0e : return _ioctrl;
+        case 0x0f : return ch.efcr;
+        default   : return 0x00;
+    }
+}
+
+void HostSc16is7xx::write(Channel &ch, byte reg, byte data) {
+    if (ch.lcr == 0xbf) {
+        switch (reg) {
+            case 0x02 : ch.efr = data; return;
+            case 0x04 : ch.xon[0] = data; return;
+            case 0x05 : ch.xon[1] = data; return;
+            case 0x06 : ch.xoff[0] = data; return;
+            case 0x07 : ch.xoff[1] = data; return;
+        }
+    } else if (ch.lcr & 0x80) {
+        switch (reg) {
+            case 0x00 : ch.dll = data; return;
+            case 0x01 : ch.dlh = data; return;
+        }
+    }
+
+    /* TCR and TLR */
+    if ((ch.mcr & 0x04) && (ch.efr & 0x10)) {
+        switch (reg) {
+            case 0x06 : ch.tcr = data; return;
+            case 0x07 : ch.tlr = data; return;
+        }
+    }
+
+    /* the general register set */
+    switch (reg) {
+        case 0x00: {
+            if (ch.tx.empty()) {
+                ch.tx_next = _now + byte_ns(ch);
+            }
+            if (ch.tx.size() < HOST_UART_FIFO) {
+                ch.tx.push_back(data);
+            }
+            break;
+        }
+
+        /* FIFO control, the reset bits clear themselves */
+        case 0x02: {
+            if (data & 0x02) {
+                ch.rx.clear();
+            }
+            if (data & 0x04) {
+                ch.tx.clear();
+            }
+            ch.fcr = data & ~0x06;
+            break;
+        }
+
+        /* SRESET resets the whole chip */
+        case 0x0e: {
+            if (data & 0x08) {
+                reset();
+            } else {
+                _ioctrl = data;
+            }
+            break;
+        }
+
+        /* the rest are plain registers */
+        case 0x01 : ch.ier = data; break;
+        case 0x03 : ch.lcr = data; break;
+        case 0x04 : ch.mcr = data; break;
+        case 0x07 : ch.spr = data; break;
+        case 0x0a : _iodir = data; break;
+        case 0x0b : _iodata = data; break;
+        case 0x0c : _ioint = data; break;
+        case 0x0f : ch.efcr = data; break;
+    }
+}
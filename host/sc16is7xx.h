@@ -0,0 +1,107 @@
+#ifndef __HOST_SC16IS7XX_H__
+#define __HOST_SC16IS7XX_H__
+
+#include <deque>
+#include <string>
+
+#include "host.h"
+
+#define HOST_UART_FIFO  64
+
+/* a register-level SC16IS752 on the SPI bus, with the far end of both serial lines and the levels on its
+ * I/O pins, the line only moves through advance(), and the IRQ line follows the interrupt sources */
+class HostSc16is7xx : public HostSpiDevice {
+public:
+    struct Channel {
+        byte             rhr  = 0;
+        byte             ier  = 0;
+        byte             fcr  = 0;
+        byte             lcr  = 0x1d;
+        byte             mcr  = 0;
+        byte             lsr  = 0;
+        byte             spr  = 0;
+        byte             tcr  = 0;
+        byte             tlr  = 0;
+        byte             efcr = 0;
+        byte             dll  = 0;
+        byte             dlh  = 0;
+        byte             efr  = 0;
+        byte             xon[2]  = {};
+        byte             xoff[2] = {};
+        std::deque<byte> rx;
+        std::deque<byte> tx;
+
+    public:
+        /* the far end, bytes on their way in, and the ones it has received */
+        std::deque<byte> line_in;
+        std::string      line_out;
+        uint64_t         rx_next = 0;
+        uint64_t         tx_next = 0;
+        uint64_t         rx_last = 0;
+        uint32_t         overruns = 0;
+    };
+
+public:
+    /* registers written, by address, and the frames seen */
+    uint32_t writes[16] = {};
+    uint32_t frames     = 0;
+
+private:
+    uint8_t  _cs;
+    int      _irq;
+    uint64_t _now    = 0;
+    bool     _level  = true;
+    byte     _iodir  = 0;
+    byte     _iodata = 0;
+    byte     _ioint  = 0;
+    byte     _ioctrl = 0;
+    byte     _input  = 0;
+    bool     _io_irq = false;
+    Channel  _ch[2];
+
+private:
+    /* the frame being clocked in, the first byte holds the address */
+    int  _pos  = 0;
+    byte _addr = 0;
+
+public:
+    /* attaches to the bus on `cs`, and drives `irq` when it is not negative */
+    explicit HostSc16is7xx(uint8_t cs, int irq = -1);
+    ~HostSc16is7xx() override;
+
+public:
+    void    select() override { _pos = 0; }
+    void    deselect() override;
+    uint8_t transfer(uint8_t data) override;
+
+public:
+    /* moves the serial lines on by `us` microseconds */
+    void advance(uint32_t us);
+
+public:
+    /* what the far end sends, and what it got so far */
+    void         send(int ch, const void *buf, size_t len);
+    std::string &received(int ch) { return _ch[ch].line_out; }
+
+public:
+    /* levels driven onto the input pins, and the ones the chip drives out */
+    void input(byte levels);
+    byte output() const { return _iodata & _iodir; }
+    byte iodir()  const { return _iodir; }
+    byte ioint()  const { return _ioint; }
+
+public:
+    const Channel &channel(int ch) const { return _ch[ch]; }
+    bool           irq() const { return !_level; }
+
+private:
+    void     reset();
+    void     update();
+    byte     read(Channel &ch, byte reg);
+    void     write(Channel &ch, byte reg, byte data);
+    bool     rx_pending(const Channel &ch) const;
+    bool     tx_pending(const Channel &ch) const;
+    uint64_t byte_ns(const Channel &ch) const;
+};
+
+#endif
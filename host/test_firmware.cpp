@@ -0,0 +1,211 @@
+#include <Updater.h>
+
+#include "host.h"
+#include "client.h"
+#include "../feel-better-soon.ino"
+
+struct Test {
+    const char *name;
+    void (*run)();
+};
+
+/* the whole /tasks body pulled in chunks of `chunk` bytes, empty if the producer gave up */
+static std::string tasks_json(size_t chunk) {
+    char        buf[512];
+    size_t      len;
+    std::string ret;
+    TasksJson   st;
+
+    /* like http_GET_tasks() */
+    st.json.begin_array();
+    while ((len = json_GET_tasks(&st, buf, chunk)) != 0) {
+        if (len == HTTP_STREAM_ABORT) {
+            return std::string();
+        } else {
+            ret.append(buf, len);
+        }
+    }
+
+    /* the end of body */
+    return ret;
+}
+
+static void task_slow() {
+    host_advance(2400000);
+}
+
+static void task_idle() {}
+
+static void test_tasks_json() {
+    std::string ref;
+
+    /* 40 minutes in a single run, past what 32 bits signed hold in microseconds */
+    CHECK(sched_periodic("slow", 0, 3600000000u, task_slow) >= 0);
+    CHECK(sched_event("idle \"quoted\"", 1, task_idle) >= 0);
+    sched_run();
+
+    /* the same body however it is chunked */
+    ref = tasks_json(512);
+    for (size_t chunk : { 1, 2, 7, 64, 300 }) {
+        CHECK(tasks_json(chunk) == ref);
+    }
+
+    /* both tasks, in a closed array */
+    CHECK(ref.front() == '[' && ref.back() == ']');
+    CHECK(ref.find("{\"name\":\"slow\",\"runs\":1,") == 1);
+    CHECK(ref.find("},{\"name\":\"idle \\\"quoted\\\"\",\"runs\":0,\"run_avg\":0.000,") != std::string::npos);
+
+    /* the times are clamped, not wrapped around to negative */
+    CHECK(ref.find("\"run_avg\":2147483.647,\"run_max\":2147483.647,") != std::string::npos);
+    CHECK(ref.find('-') == std::string::npos);
+}
+
+static void test_tasks_overflow() {
+    static std::string name(200, 'x');
+
+    /* a name longer than the staging buffer can not be sent whole */
+    CHECK(sched_event(name.c_str(), 2, task_idle) >= 0);
+    for (size_t chunk : { 1, 64, 512 }) {
+        CHECK(tasks_json(chunk).empty());
+    }
+}
+
+static int Woken = 0;
+
+static void task_woken() {
+    Woken++;
+}
+
+static void test_notify_range() {
+    int task;
+
+    /* ids that name no task are ignored, even a free slot */
+    sched_notify(-1);
+    sched_notify(static_cast<int>(sched_count()));
+    sched_notify(SCHED_MAX_TASKS);
+
+    /* so a task added into that slot is not woken up yet */
+    CHECK((task = sched_event("woken", 0, task_woken)) >= 0);
+    sched_run();
+    CHECK(Woken == 0);
+
+    /* while its own id still works */
+    sched_notify(task);
+    sched_run();
+    CHECK(Woken == 1);
+}
+
+/* sha256sum of ota_image() */
+static const char OTA_digest[] = "c33e271d1d90b8d5615d100ea4a90d2f83adf72f0805935142f179b8c3838a73";
+
+/* a pattern that shows reordering and loss, larger than the request buffer */
+static std::string ota_image() {
+    std::string ret(20000, 0);
+    for (size_t i = 0; i < ret.size(); i++) {
+        ret[i] = static_cast<char>(i * 7 + i / 251);
+    }
+    return ret;
+}
+
+static std::string ota_request(const std::string &image, const char *digest) {
+    char buf[256];
+    snprintf(
+        buf,
+        sizeof(buf),
+        "POST /firmware HTTP/1.1\r\nHost: test\r\nContent-Length: %zu\r\nX-Firmware-SHA256: %s\r\n\r\n",
+        image.size(),
+        digest
+    );
+    return buf + image;
+}
+
+/* runs before ota_update(), the image that was committed blocks any later upload until the reboot */
+static void test_ota_mismatch() {
+    uint16_t              port   = host_free_port();
+    HttpServer            srv(port, HttpRoutes, &PagesBundle, nullptr);
+    HostClient            cl;
+    HostReply             reply;
+    std::string           image  = ota_image();
+    std::string           digest = OTA_digest;
+    std::function<void()> idle   = [&] { srv.poll(); };
+
+    /* the whole image, with one digit of the digest off */
+    digest.back() = digest.back() == '0' ? '1' : '0';
+    srv.begin();
+    CHECK(cl.connect(port));
+    CHECK(cl.send(ota_request(image, digest.c_str()), idle));
+    CHECK(cl.wait(reply, idle) && reply.status == 400);
+    CHECK(ota_status() == OtaStatus::Mismatch);
+    CHECK(ota_owner() == nullptr);
+
+    /* the last byte was held back, so the partition never held a bootable image */
+    CHECK(Update.image().size() == image.size() - 1);
+
+    /* and nothing reboots */
+    auto restarts = host_restarts();
+    host_advance(OTA_REBOOT_DELAY * 2);
+    ota_poll();
+    CHECK(host_restarts() == restarts);
+}
+
+static void test_ota_update() {
+    uint16_t              port  = host_free_port();
+    HttpServer            srv(port, HttpRoutes, &PagesBundle, nullptr);
+    HostClient            first;
+    HostClient            second;
+    HostReply             reply;
+    std::string           image = ota_image();
+    std::string           req   = ota_request(image, OTA_digest);
+    size_t                half  = req.size() / 2;
+    std::function<void()> idle  = [&] { srv.poll(); };
+
+    /* the first uploader is half way through */
+    srv.begin();
+    CHECK(first.connect(port));
+    CHECK(first.send(std::string_view(req).substr(0, half), idle));
+    for (int i = 0; i < 1000 && ota_status() != OtaStatus::Running; i++) {
+        srv.poll();
+    }
+    CHECK(ota_status() == OtaStatus::Running);
+    CHECK(ota_stats().written < image.size());
+
+    /* a second one is turned away, and does not disturb it */
+    CHECK(second.connect(port));
+    CHECK(second.send(req, idle));
+    CHECK(second.wait(reply, idle) && reply.status == 409);
+    CHECK(ota_status() == OtaStatus::Running);
+
+    /* the first one completes, with the image byte for byte in the partition */
+    CHECK(first.send(std::string_view(req).substr(half), idle));
+    CHECK(first.wait(reply, idle) && reply.status == 200);
+    CHECK(reply.body.find("size 20000\n") == 0);
+    CHECK(ota_status() == OtaStatus::Done);
+    CHECK(Update.image().size() == image.size());
+    CHECK(memcmp(Update.image().data(), image.data(), image.size()) == 0);
+
+    /* the device restarts once the delay is over */
+    auto restarts = host_restarts();
+    ota_poll();
+    CHECK(host_restarts() == restarts);
+    host_advance(OTA_REBOOT_DELAY);
+    ota_poll();
+    CHECK(host_restarts() == restarts + 1);
+}
+
+static const Test Tests[] = {
+    { "tasks_json"     , test_tasks_json     },
+    { "tasks_overflow" , test_tasks_overflow },
+    { "notify_range"   , test_notify_range   },
+    { "ota_mismatch"   , test_ota_mismatch   },
+    { "ota_update"     , test_ota_update     },
+};
+
+int main(int argc, char **argv) {
+    for (const auto &v : Tests) {
+        if (argc < 2 || !strcmp(argv[1], v.name)) {
+            printf("%s\n", v.name);
+            v.run();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,867 @@
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <sys/stat.h>
+
+#include "host.h"
+#include "client.h"
+#include "pages.h"
+#include "httpserver.h"
+
+struct Test {
+    const char *name;
+    void (*run)();
+};
+
+static const char TYPE_text_plain[] PROGMEM = "text/plain";
+
+static const char PATH_hello[]  PROGMEM = "/hello";
+static const char PATH_query[]  PROGMEM = "/query";
+static const char PATH_sample[] PROGMEM = "/samples/{id}";
+static const char PATH_broken[] PROGMEM = "/broken";
+static const char PATH_events[] PROGMEM = "/events";
+static const char PATH_ws[]     PROGMEM = "/ws";
+static const char PATH_echo[]   PROGMEM = "/echo";
+static const char PATH_upload[] PROGMEM = "/upload";
+
+static std::string WsText;
+
+/* keeps the last text frame, and echoes it to every subscriber */
+static void ws_echo(HttpWebSocket &ws, bool binary, char *data, size_t len) {
+    if (!binary) {
+        WsText.assign(data, len);
+        ws.write(data, len);
+    }
+}
+
+static HttpEventStream Events;
+static HttpWebSocket   Channel(ws_echo);
+
+static const char HEAD_stream[] PROGMEM = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+
+static HttpResponse http_GET_hello(const HttpRequest &req) {
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, 6);
+    resp.add_P("hello\n", 6);
+    return resp;
+}
+
+static HttpResponse http_GET_query(const HttpRequest &req) {
+    auto body = req.arena->sprintf("%.*s\n", static_cast<int>(req.query.size()), req.query.data());
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, body.size());
+    resp.add(body);
+    return resp;
+}
+
+static HttpResponse http_POST_echo(const HttpRequest &req) {
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, req.body.size());
+    resp.add(req.body);
+    return resp;
+}
+
+static std::string Upload;
+static size_t      UploadLimit   = SIZE_MAX;
+static bool        UploadRefused = false;
+
+/* keeps the body, which must arrive in order, and refuses anything past UploadLimit */
+static bool sink_POST_upload(const HttpRequest &req, size_t off, const char *buf, size_t len) {
+    if (off != Upload.size() || off + len > UploadLimit) {
+        UploadRefused = true;
+        return false;
+    }
+
+    /* append the piece */
+    Upload.append(buf, len);
+    return true;
+}
+
+static HttpResponse http_POST_upload(const HttpRequest &req) {
+    if (UploadRefused) {
+        return HttpResponse::error(*req.arena, 413);
+    }
+
+    /* the size of what was kept */
+    auto body = req.arena->sprintf("%zu\n", Upload.size());
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, body.size());
+    resp.add(body);
+    return resp;
+}
+
+static HttpResponse http_GET_sample(const HttpRequest &req) {
+    auto id   = req.param("id");
+    auto body = req.arena->sprintf("%.*s\n", static_cast<int>(id.size()), id.data());
+    auto resp = HttpResponse::head(*req.arena, 200, TYPE_text_plain, body.size());
+    resp.add(body);
+    return resp;
+}
+
+static size_t produce_broken(void *ctx, char *buf, size_t len) {
+    auto sent = static_cast<size_t *>(ctx);
+
+    /* some of the body, then give up */
+    if (*sent >= 1000) {
+        return HTTP_STREAM_ABORT;
+    }
+
+    /* at most 100 bytes per call */
+    len = std::min<size_t>(len, 100);
+    memset(buf, 'x', len);
+    *sent += len;
+    return len;
+}
+
+static HttpResponse http_GET_broken(const HttpRequest &req) {
+    auto sent = req.arena->alloc<size_t>(1);
+    *sent = 0;
+    return HttpResponse::stream(HEAD_stream, produce_broken, sent);
+}
+
+static HttpResponse http_GET_events(const HttpRequest &req) {
+    return HttpResponse::subscribe(Events);
+}
+
+static HttpResponse http_GET_ws(const HttpRequest &req) {
+    return HttpResponse::upgrade(Channel);
+}
+
+static const HttpRoutingTable Routes[] PROGMEM = {
+    { HttpMethod::GET  , PATH_hello  , http_GET_hello   , nullptr          },
+    { HttpMethod::GET  , PATH_query  , http_GET_query   , nullptr          },
+    { HttpMethod::GET  , PATH_sample , http_GET_sample  , nullptr          },
+    { HttpMethod::GET  , PATH_broken , http_GET_broken  , nullptr          },
+    { HttpMethod::GET  , PATH_events , http_GET_events  , nullptr          },
+    { HttpMethod::GET  , PATH_ws     , http_GET_ws      , nullptr          },
+    { HttpMethod::POST , PATH_echo   , http_POST_echo   , nullptr          },
+    { HttpMethod::POST , PATH_upload , http_POST_upload , sink_POST_upload },
+    {},
+};
+
+/* a server on a free port, `idle` runs it once */
+struct Fixture {
+    uint16_t              port = host_free_port();
+    HttpServer            srv;
+    std::function<void()> idle = [this] { srv.poll(); };
+
+public:
+    explicit Fixture(fs::FS *fs = nullptr, const HttpBundle *bundle = &PagesBundle) : srv(port, Routes, bundle, fs) {
+        srv.begin();
+    }
+};
+
+/* one request on a fresh connection */
+static HostReply fetch(Fixture &fx, const std::string &req) {
+    HostClient cl;
+    HostReply  reply;
+
+    /* the reply must arrive in time */
+    CHECK(cl.connect(fx.port));
+    CHECK(cl.send(req, fx.idle));
+    CHECK(cl.wait(reply, fx.idle));
+    return reply;
+}
+
+/* a scratch directory standing in for the flash partition */
+static std::string make_root() {
+    char tmp[] = "/tmp/test_http.XXXXXX";
+    CHECK(mkdtemp(tmp) != nullptr);
+    return tmp;
+}
+
+static void make_file(const std::string &path, const std::string &data) {
+    std::ofstream(path, std::ios::binary) << data;
+}
+
+static void test_pipeline() {
+    Fixture    fx;
+    HostClient cl;
+    HostReply  reply;
+
+    /* the query string of one request must not be looked up past its own target */
+    CHECK(cl.connect(fx.port));
+    CHECK(cl.send(
+        "GET /hello HTTP/1.1\r\nHost: test\r\n\r\n"
+        "GET /query?a=1 HTTP/1.1\r\nHost: test\r\n\r\n"
+        "GET /samples/42 HTTP/1.1\r\nHost: test\r\n\r\n"
+        "GET /query HTTP/1.1\r\nHost: test\r\n\r\n"
+        "GET /hello?x HTTP/1.1\r\nHost: test\r\n\r\n",
+        fx.idle
+    ));
+
+    /* replies come back in order */
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "hello\n");
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "a=1\n");
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "42\n");
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "\n");
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "hello\n");
+}
+
+static void test_parked() {
+    Fixture    fx;
+    HostClient peers[HTTP_MAX_CONNS];
+    HostReply  reply;
+
+    /* every slot holds a kept-alive connection waiting for its next request, the first one the longest */
+    for (auto &cl : peers) {
+        CHECK(cl.connect(fx.port));
+        CHECK(cl.send("GET /hello HTTP/1.1\r\nHost: test\r\n\r\n", fx.idle));
+        CHECK(cl.wait(reply, fx.idle) && reply.status == 200);
+        host_advance(100);
+    }
+
+    /* a new client takes the slot of the oldest one */
+    reply = fetch(fx, "GET /hello HTTP/1.1\r\nHost: test\r\n\r\n");
+    CHECK(reply.status == 200);
+    CHECK(fx.srv.stats().rejected == 0);
+
+    /* which is closed in an orderly way, the others stay */
+    peers[0].pump();
+    CHECK(peers[0].closed() && !peers[0].reset());
+    for (size_t i = 1; i < HTTP_MAX_CONNS; i++) {
+        CHECK(peers[i].send("GET /hello HTTP/1.1\r\nHost: test\r\n\r\n", fx.idle));
+        CHECK(peers[i].wait(reply, fx.idle) && reply.status == 200);
+    }
+}
+
+static void test_shared_buffers() {
+    Fixture    fx;
+    HostClient slow[HTTP_MAX_BUFFERS];
+    HostClient late;
+    HostReply  reply;
+
+    /* partial requests hold every request buffer */
+    for (auto &cl : slow) {
+        CHECK(cl.connect(fx.port));
+        CHECK(cl.send("GET /hello HTTP/1.1\r\n", fx.idle));
+    }
+
+    /* so a complete one waits in its socket, not turned away */
+    CHECK(late.connect(fx.port));
+    CHECK(late.send("GET /hello HTTP/1.1\r\nHost: test\r\n\r\n", fx.idle));
+    for (int i = 0; i < 100; i++) {
+        fx.srv.poll();
+    }
+    CHECK(!late.take(reply) && late.raw().empty());
+    CHECK(fx.srv.stats().waited != 0 && fx.srv.stats().rejected == 0);
+
+    /* until one of the others is done with its buffer */
+    CHECK(slow[0].send("Host: test\r\n\r\n", fx.idle));
+    CHECK(slow[0].wait(reply, fx.idle) && reply.status == 200);
+    CHECK(late.wait(reply, fx.idle) && reply.status == 200);
+
+    /* and parked connections hold none, so the one left is free for a new client */
+    CHECK(fetch(fx, "GET /hello HTTP/1.1\r\nHost: test\r\n\r\n").status == 200);
+    CHECK(slow[1].send("Host: test\r\n\r\n", fx.idle));
+    CHECK(slow[1].wait(reply, fx.idle) && reply.status == 200);
+}
+
+static void test_no_malloc() {
+    Fixture    fx;
+    HostClient cl;
+    HostReply  reply;
+    uint64_t   allocs = 0;
+    auto       idle   = [&] { auto n = host_allocs(); fx.srv.poll(); allocs += host_allocs() - n; };
+
+    /* handlers, path parameters, query strings, bundled assets and errors */
+    static const char *const reqs[] = {
+        "GET /hello HTTP/1.1\r\nHost: test\r\n\r\n",
+        "GET /samples/42 HTTP/1.1\r\nHost: test\r\nAccept: */*\r\n\r\n",
+        "GET /query?a=1&b=2 HTTP/1.1\r\nHost: test\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: test\r\nAccept-Encoding: gzip\r\n\r\n",
+        "GET /missing HTTP/1.1\r\nHost: test\r\n\r\n",
+    };
+
+    /* the first round accepts the connection */
+    CHECK(cl.connect(fx.port));
+    for (int round = 0; round < 3; round++) {
+        allocs = 0;
+        for (auto req : reqs) {
+            CHECK(cl.send(req, idle));
+            CHECK(cl.wait(reply, idle));
+        }
+
+        /* a kept-alive connection serves without touching the heap */
+        if (round != 0) {
+            CHECK(allocs == 0);
+        }
+    }
+}
+
+static void test_empty_path() {
+    auto    root = make_root();
+    fs::FS  disk(root);
+    Fixture fx(&disk);
+
+    /* the target is only a query string, so there is no file to look up */
+    CHECK(fetch(fx, "GET ?a HTTP/1.1\r\nHost: test\r\n\r\n").status == 400);
+    CHECK(fetch(fx, "GET ? HTTP/1.1\r\nHost: test\r\n\r\n").status == 400);
+    std::filesystem::remove_all(root);
+}
+
+static void test_content_length() {
+    Fixture fx;
+
+    /* only plain digits, and only values that fit */
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: -5\r\n\r\n").status == 400);
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: +5\r\n\r\nhello").status == 400);
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: 0x5\r\n\r\nhello").status == 400);
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: \r\n\r\n").status == 400);
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: 99999999999999999999999\r\n\r\n").status == 400);
+
+    /* the largest size_t must not wrap around the buffer size check */
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: 18446744073709551615\r\n\r\n").status == 413);
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: 18446744073709551611\r\n\r\n").status == 413);
+
+    /* a body that fits */
+    auto reply = fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nContent-Length: 5\r\n\r\nhello");
+    CHECK(reply.status == 200 && reply.body == "hello");
+}
+
+/* every pair of `query` as "name=value", decoded */
+static std::string query_pairs(std::string query) {
+    std::string_view name;
+    std::string_view value;
+    std::string      ret;
+    HttpQuery        q(query);
+
+    /* one pair per line */
+    while (q.next(name, value)) {
+        ret.append(name).append("=").append(value).append("\n");
+    }
+    return ret;
+}
+
+static void test_query() {
+    /* '+' is a space, escapes in both names and values, in either case */
+    CHECK(query_pairs("a=1&b=hello+world&%63=%41%2b%2f%3d%26") == "a=1\nb=hello world\nc=A+/=&\n");
+    CHECK(query_pairs("x=%e2%82%AC") == "x=\xe2\x82\xac\n");
+
+    /* empty pairs are skipped, names without a value have an empty one */
+    CHECK(query_pairs("&&a=1&&flag&=2&") == "a=1\nflag=\n=2\n");
+    CHECK(query_pairs("").empty());
+
+    /* the first '=' splits, the rest is part of the value */
+    CHECK(query_pairs("a=b=c") == "a=b=c\n");
+
+    /* malformed and truncated escapes are kept as they are */
+    CHECK(query_pairs("a=%zz&b=%4&c=%&d=100%") == "a=%zz\nb=%4\nc=%\nd=100%\n");
+
+    /* a decoded '&' does not split */
+    CHECK(query_pairs("a=1%262&b=2") == "a=1&2\nb=2\n");
+}
+
+static void test_chunked() {
+    Fixture    fx;
+    HostClient cl;
+    HostReply  reply;
+
+    /* the chunk headers split at every awkward place, with a request pipelined right after the body */
+    static const char *parts[] = {
+        "POST /echo HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n5",
+        "\r",
+        "\nhel",
+        "lo\r\n6;ext=1\r\n wor",
+        "ld\r\n0\r\n",
+        "\r\nGET /hello HTTP/1.1\r\nHost: test\r\n\r\n",
+    };
+
+    /* each part is seen by the server on its own */
+    CHECK(cl.connect(fx.port));
+    for (auto part : parts) {
+        CHECK(cl.send(part, fx.idle));
+        for (int i = 0; i < 10; i++) {
+            fx.srv.poll();
+        }
+    }
+
+    /* the decoded body, then the pipelined request */
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "hello world");
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "hello\n");
+
+    /* malformed chunk sizes, and codings other than "chunked" */
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\nhello\r\n0\r\n\r\n").status == 400);
+    CHECK(fetch(fx, "POST /echo HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: gzip\r\n\r\n").status == 501);
+}
+
+/* a chunked body with pieces of `size` bytes */
+static std::string chunked_body(const std::string &data, size_t size) {
+    char        buf[16];
+    std::string ret;
+
+    /* the chunks, then the last one */
+    for (size_t i = 0; i < data.size(); i += size) {
+        auto part = data.substr(i, size);
+        snprintf(buf, sizeof(buf), "%zx\r\n", part.size());
+        ret += buf + part + "\r\n";
+    }
+    return ret + "0\r\n\r\n";
+}
+
+static void test_body_sink() {
+    Fixture     fx;
+    HostClient  cl;
+    HostReply   reply;
+    std::string data(10000, 0);
+
+    /* a pattern that shows reordering and loss, more than twice the request buffer */
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 7 + i / 251);
+    }
+
+    /* the whole body reaches the sink, in order */
+    Upload.clear();
+    UploadLimit = SIZE_MAX;
+    UploadRefused = false;
+    CHECK(cl.connect(fx.port));
+    CHECK(cl.send("POST /upload HTTP/1.1\r\nHost: test\r\nContent-Length: 10000\r\n\r\n" + data, fx.idle));
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "10000\n");
+    CHECK(Upload == data);
+
+    /* chunked too, on the same connection */
+    Upload.clear();
+    CHECK(cl.send("POST /upload HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n" + chunked_body(data, 3000), fx.idle));
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200 && reply.body == "10000\n");
+    CHECK(Upload == data);
+
+    /* and the connection still serves */
+    CHECK(cl.send("GET /hello HTTP/1.1\r\nHost: test\r\n\r\n", fx.idle));
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 200);
+    cl.close();
+
+    /* a sink that refuses the body gets the handler called right away, and the connection closed */
+    Upload.clear();
+    UploadLimit = 2000;
+    CHECK(cl.connect(fx.port));
+    CHECK(cl.send("POST /upload HTTP/1.1\r\nHost: test\r\nContent-Length: 3000\r\n\r\n" + data.substr(0, 3000), fx.idle));
+    CHECK(cl.wait(reply, fx.idle) && reply.status == 413);
+    CHECK(Upload.size() <= 2000);
+    for (int i = 0; i < 1000 && !cl.closed(); i++) {
+        fx.srv.poll();
+        cl.pump();
+    }
+    CHECK(cl.closed());
+    UploadLimit = SIZE_MAX;
+}
+
+/* what "mkpages.py" makes of a compressed and a plain file */
+static const char ASSET_strings[] PROGMEM =
+    "text/css\000"
+    "\"00000000000000aa\"\000"
+    "\"00000000000000bb\"\000"
+    "/app.css\000"
+    "/plain.css";
+
+static const uint8_t ASSET_data[] PROGMEM = {
+    0x1f, 0x8b, 0x08, 0x00, 'z', 'i', 'p', 'p', 'e', 'd',
+    'b', 'o', 'd', 'y', '{', '}',
+};
+
+static const HttpBundleEntry ASSET_index[] PROGMEM = {
+    {    47,   8,     0,     9,        0,       10, true  },    // /app.css
+    {    56,  10,     0,    28,       10,        6, false },    // /plain.css
+};
+
+static const HttpBundle AssetBundle = {
+    sizeof(ASSET_index) / sizeof(ASSET_index[0]),
+    ASSET_index,
+    ASSET_strings,
+    ASSET_data,
+};
+
+/* GET `path` with the extra `headers` */
+static HostReply fetch_asset(Fixture &fx, const char *path, const std::string &headers) {
+    return fetch(fx, std::string("GET ") + path + " HTTP/1.1\r\nHost: test\r\n" + headers + "\r\n");
+}
+
+static void test_assets() {
+    Fixture   fx(nullptr, &AssetBundle);
+    HostReply reply;
+    auto      gzip = std::string("\x1f\x8b\x08\x00zipped", 10);
+    auto      etag = std::string("\"00000000000000aa\"");
+
+    /* the compressed bytes as they are, labelled as such */
+    reply = fetch_asset(fx, "/app.css", "Accept-Encoding: deflate, gzip\r\n");
+    CHECK(reply.status == 200 && reply.body == gzip);
+    CHECK(reply.header("content-encoding") == "gzip");
+    CHECK(reply.header("vary") == "Accept-Encoding");
+    CHECK(reply.header("etag") == etag);
+
+    /* no preference takes anything, the wildcard too, unless gzip itself is refused */
+    CHECK(fetch_asset(fx, "/app.css", "").status == 200);
+    CHECK(fetch_asset(fx, "/app.css", "Accept-Encoding: *\r\n").status == 200);
+    CHECK(fetch_asset(fx, "/app.css", "Accept-Encoding: identity\r\n").status == 406);
+    CHECK(fetch_asset(fx, "/app.css", "Accept-Encoding: gzip;q=0\r\n").status == 406);
+    CHECK(fetch_asset(fx, "/app.css", "Accept-Encoding: gzip;q=0.0, *\r\n").status == 406);
+    CHECK(fetch_asset(fx, "/app.css", "Accept-Encoding: gzip;q=0.5\r\n").status == 200);
+
+    /* a fresh copy is revalidated without the body, weak tags and lists included */
+    reply = fetch_asset(fx, "/app.css", "If-None-Match: " + etag + "\r\n");
+    CHECK(reply.status == 304 && reply.body.empty());
+    CHECK(reply.header("etag") == etag);
+    CHECK(fetch_asset(fx, "/app.css", "If-None-Match: W/" + etag + "\r\n").status == 304);
+    CHECK(fetch_asset(fx, "/app.css", "If-None-Match: \"other\", " + etag + "\r\n").status == 304);
+    CHECK(fetch_asset(fx, "/app.css", "If-None-Match: *\r\n").status == 304);
+
+    /* a stale one gets the whole asset */
+    reply = fetch_asset(fx, "/app.css", "If-None-Match: \"00000000000000bb\"\r\n");
+    CHECK(reply.status == 200 && reply.body == gzip);
+
+    /* plain assets carry no encoding */
+    reply = fetch_asset(fx, "/plain.css", "Accept-Encoding: identity\r\n");
+    CHECK(reply.status == 200 && reply.body == "body{}");
+    CHECK(reply.header("content-encoding").empty());
+    CHECK(reply.header("etag") == "\"00000000000000bb\"");
+}
+
+static void test_files() {
+    auto        root = make_root();
+    fs::FS      disk(root);
+    Fixture     fx(&disk);
+    HostReply   reply;
+    std::string log;
+
+    /* larger than the socket send buffer */
+    for (int i = 0; log.size() < 10000; i++) {
+        log += std::to_string(i) + "\n";
+    }
+
+    /* the files and directories being served */
+    log.resize(10000);
+    make_file(root + "/log.txt", log);
+    make_file(root + "/empty.txt", "");
+    CHECK(mkdir((root + "/sub").c_str(), 0755) == 0);
+    CHECK(mkdir((root + "/sub/dir").c_str(), 0755) == 0);
+    make_file(root + "/sub/index.html", "<p>index</p>");
+
+    /* the whole file */
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\n\r\n");
+    CHECK(reply.status == 200 && reply.body == log);
+    CHECK(reply.header("accept-ranges") == "bytes");
+    CHECK(reply.header("content-type") == "text/plain");
+
+    /* a closed range */
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=100-199\r\n\r\n");
+    CHECK(reply.status == 206 && reply.body == log.substr(100, 100));
+    CHECK(reply.header("content-range") == "bytes 100-199/10000");
+
+    /* an open range, and one that runs past the end */
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=9990-\r\n\r\n");
+    CHECK(reply.status == 206 && reply.body == log.substr(9990));
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=9000-20000\r\n\r\n");
+    CHECK(reply.status == 206 && reply.body == log.substr(9000));
+    CHECK(reply.header("content-range") == "bytes 9000-9999/10000");
+
+    /* the last bytes */
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=-10\r\n\r\n");
+    CHECK(reply.status == 206 && reply.body == log.substr(9990));
+
+    /* nothing to send */
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=10000-\r\n\r\n");
+    CHECK(reply.status == 416 && reply.header("content-range") == "bytes */10000");
+    reply = fetch(fx, "GET /empty.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=-1\r\n\r\n");
+    CHECK(reply.status == 416 && reply.header("content-range") == "bytes */0");
+
+    /* served in whole: several ranges, a reversed one, and "If-Range" */
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=0-1,5-6\r\n\r\n");
+    CHECK(reply.status == 200 && reply.body == log);
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=20-10\r\n\r\n");
+    CHECK(reply.status == 200 && reply.body == log);
+    reply = fetch(fx, "GET /log.txt HTTP/1.1\r\nHost: test\r\nRange: bytes=0-9\r\nIf-Range: \"x\"\r\n\r\n");
+    CHECK(reply.status == 200 && reply.body == log);
+
+    /* directories are served by their index, and never themselves */
+    reply = fetch(fx, "GET /sub/ HTTP/1.1\r\nHost: test\r\n\r\n");
+    CHECK(reply.status == 200 && reply.body == "<p>index</p>");
+    CHECK(reply.header("content-type") == "text/html");
+    CHECK(fetch(fx, "GET /sub/dir HTTP/1.1\r\nHost: test\r\n\r\n").status == 404);
+    CHECK(fetch(fx, "GET /sub/dir/ HTTP/1.1\r\nHost: test\r\n\r\n").status == 404);
+
+    /* nothing outside the root */
+    CHECK(fetch(fx, "GET /sub/../../etc/passwd HTTP/1.1\r\nHost: test\r\n\r\n").status == 404);
+    CHECK(fetch(fx, "GET /.. HTTP/1.1\r\nHost: test\r\n\r\n").status == 404);
+    CHECK(fetch(fx, "GET /missing.txt HTTP/1.1\r\nHost: test\r\n\r\n").status == 404);
+    std::filesystem::remove_all(root);
+}
+
+static void test_stream_abort() {
+    Fixture    fx;
+    HostClient cl;
+    HostReply  reply;
+
+    /* the connection closes before the last chunk, so the body never completes */
+    CHECK(cl.connect(fx.port));
+    CHECK(cl.send("GET /broken HTTP/1.1\r\nHost: test\r\n\r\n", fx.idle));
+    CHECK(!cl.wait(reply, fx.idle));
+    CHECK(cl.closed() && cl.raw().find("\r\n0\r\n") == std::string::npos);
+    CHECK(cl.raw().find("Transfer-Encoding: chunked") != std::string::npos);
+}
+
+static void test_slow_download() {
+    auto        root = make_root();
+    fs::FS      disk(root);
+    Fixture     fx(&disk);
+    HostClient  cl;
+    HostReply   reply;
+    std::string data;
+
+    /* takes 80 seconds at 4 KB/s */
+    for (uint32_t i = 0; data.size() < 320 * 1024; i++) {
+        data += std::to_string(i * 2654435761u) + "\n";
+    }
+
+    /* a client on a slow but steady link */
+    make_file(root + "/big.bin", data);
+    CHECK(cl.connect(fx.port, 4096));
+    CHECK(cl.send("GET /big.bin HTTP/1.1\r\nHost: test\r\n\r\n", fx.idle));
+    for (int i = 0; i < 600 && !cl.take(reply); i++) {
+        host_advance(250);
+        fx.srv.poll();
+        cl.pump(1024);
+    }
+
+    /* the download is never cut off while it keeps moving */
+    CHECK(reply.status == 200 && reply.body == data);
+    CHECK(fx.srv.stats().evicted == 0);
+    std::filesystem::remove_all(root);
+}
+
+static void test_trickle_download() {
+    auto        root = make_root();
+    fs::FS      disk(root);
+    Fixture     fx(&disk);
+    HostClient  cl;
+
+    /* a client that reads a few bytes every other second */
+    make_file(root + "/big.bin", std::string(256 * 1024, 'x'));
+    CHECK(cl.connect(fx.port, 4096));
+    CHECK(cl.send("GET /big.bin HTTP/1.1\r\nHost: test\r\n\r\n", fx.idle));
+    for (int i = 0; i < 60 && !cl.closed(); i++) {
+        host_advance(1000);
+        fx.srv.poll();
+        cl.pump(i % 2 == 0 ? 16 : 0);
+    }
+
+    /* reset once the send window stops draining */
+    for (int i = 0; i < 10 && !cl.closed(); i++) {
+        fx.srv.poll();
+        cl.pump();
+    }
+
+    /* the slot is freed */
+    CHECK(cl.reset());
+    CHECK(fx.srv.stats().evicted == 1);
+    std::filesystem::remove_all(root);
+}
+
+static const char REQ_events[] =
+    "GET /events HTTP/1.1\r\n"
+    "Host: test\r\n"
+    "Accept: text/event-stream\r\n"
+    "\r\n";
+
+static const char REQ_ws[] =
+    "GET /ws HTTP/1.1\r\n"
+    "Host: test\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+/* peers that never read and one that does, all subscribed with `req` while `publish` runs every 100 ms */
+static void check_stalled_peers(const char *req, void (*publish)()) {
+    Fixture    fx;
+    HostClient peers[HTTP_MAX_SUBSCRIBERS];
+    HostReply  reply;
+    auto &     live = peers[HTTP_MAX_SUBSCRIBERS - 1];
+
+    /* all the subscriber slots are taken */
+    for (auto &cl : peers) {
+        CHECK(cl.connect(fx.port, 4096));
+        CHECK(cl.send(req, fx.idle));
+    }
+
+    /* wait for the subscriptions */
+    for (int i = 0; i < 100; i++) {
+        fx.srv.poll();
+    }
+
+    /* the reader only drains what arrives, without parsing it */
+    for (int i = 0; i < 300; i++) {
+        host_advance(100);
+        publish();
+        fx.srv.poll();
+        live.pump();
+        live.raw().clear();
+    }
+
+    /* the stalled peers are reset, the reader stays */
+    CHECK(fx.srv.stats().evicted == HTTP_MAX_SUBSCRIBERS - 1);
+    for (auto &cl : peers) {
+        if (&cl != &live) {
+            cl.pump();
+            CHECK(cl.reset());
+        }
+    }
+
+    /* and their slots serve again */
+    CHECK(live.connected());
+    reply = fetch(fx, "GET /hello HTTP/1.1\r\nHost: test\r\n\r\n");
+    CHECK(reply.status == 200);
+}
+
+static void publish_event() {
+    static char data[200];
+    memset(data, 'e', sizeof(data) - 1);
+    Events.publish("sample", data);
+}
+
+static void publish_frame() {
+    static char data[200];
+    memset(data, 'w', sizeof(data));
+    Channel.write(data, sizeof(data));
+}
+
+static void test_stalled_events() {
+    check_stalled_peers(REQ_events, publish_event);
+}
+
+static void test_stalled_websocket() {
+    check_stalled_peers(REQ_ws, publish_frame);
+}
+
+/* runs the server until `cl` has received the status line and headers */
+static std::string wait_head(Fixture &fx, HostClient &cl) {
+    for (int i = 0; i < 1000 && cl.raw().find("\r\n\r\n") == std::string::npos; i++) {
+        fx.srv.poll();
+        cl.pump();
+    }
+    return cl.raw().substr(0, cl.raw().find("\r\n"));
+}
+
+/* runs the server until `cl` has `len` bytes, or nothing more comes */
+static void wait_bytes(Fixture &fx, HostClient &cl, size_t len) {
+    for (int i = 0; i < 1000 && cl.raw().size() < len; i++) {
+        fx.srv.poll();
+        cl.pump();
+    }
+}
+
+/* a subscriber to Channel past the handshake, with the reply headers consumed */
+static void ws_open(Fixture &fx, HostClient &cl) {
+    CHECK(cl.connect(fx.port));
+    CHECK(cl.send(REQ_ws, fx.idle));
+    CHECK(wait_head(fx, cl) == "HTTP/1.1 101 Switching Protocols");
+    cl.raw().erase(0, cl.raw().find("\r\n\r\n") + 4);
+}
+
+static void test_ws_accept() {
+    Fixture    fx;
+    HostClient cl;
+
+    /* the key and accept value from RFC 6455 section 1.3 */
+    CHECK(cl.connect(fx.port));
+    CHECK(cl.send(REQ_ws, fx.idle));
+    CHECK(wait_head(fx, cl) == "HTTP/1.1 101 Switching Protocols");
+    CHECK(cl.raw().find("\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos);
+}
+
+static void test_ws_masked() {
+    Fixture    fx;
+    HostClient cl;
+
+    /* a text frame with "hello", masked with the key from RFC 6455 section 5.7 */
+    static const char frame[] = "\x81\x85\x37\xfa\x21\x3d\x5f\x9f\x4d\x51\x58";
+    ws_open(fx, cl);
+    WsText.clear();
+    CHECK(cl.send(std::string_view(frame, sizeof(frame) - 1), fx.idle));
+
+    /* the handler gets it unmasked, and the echo comes back as an unmasked binary frame */
+    wait_bytes(fx, cl, 7);
+    CHECK(WsText == "hello");
+    CHECK(cl.raw() == std::string("\x82\x05hello", 7));
+}
+
+static void test_ws_batch() {
+    Fixture    fx;
+    HostClient cl;
+
+    /* writes between two polls go out as a single frame */
+    ws_open(fx, cl);
+    CHECK(Channel.write("abc", 3));
+    CHECK(Channel.write("def", 3));
+    wait_bytes(fx, cl, 8);
+    CHECK(cl.raw() == std::string("\x82\x06" "abcdef", 8));
+
+    /* and are not sent again on the next polls */
+    for (int i = 0; i < 10; i++) {
+        fx.srv.poll();
+        cl.pump();
+    }
+    CHECK(cl.raw().size() == 8);
+
+    /* the next write starts a new frame */
+    CHECK(Channel.write("gh", 2));
+    wait_bytes(fx, cl, 12);
+    CHECK(cl.raw() == std::string("\x82\x06" "abcdef" "\x82\x02" "gh", 12));
+}
+
+static void test_subscriber_cap() {
+    Fixture    fx;
+    HostClient subs[HTTP_MAX_SUBSCRIBERS];
+    HostClient late;
+    HostReply  reply;
+
+    /* event streams and WebSockets share the subscriber slots */
+    for (size_t i = 0; i < HTTP_MAX_SUBSCRIBERS; i++) {
+        CHECK(subs[i].connect(fx.port));
+        CHECK(subs[i].send(i % 2 == 0 ? REQ_events : REQ_ws, fx.idle));
+        CHECK(wait_head(fx, subs[i]) == (i % 2 == 0 ? "HTTP/1.1 200 OK" : "HTTP/1.1 101 Switching Protocols"));
+    }
+
+    /* one more is turned away */
+    CHECK(late.connect(fx.port));
+    CHECK(late.send(REQ_events, fx.idle));
+    CHECK(late.wait(reply, fx.idle) && reply.status == 503);
+    late.close();
+
+    /* while plain requests are still served */
+    CHECK(fetch(fx, "GET /hello HTTP/1.1\r\nHost: test\r\n\r\n").status == 200);
+
+    /* and a subscriber that leaves makes room for the next one */
+    subs[0].close();
+    CHECK(late.connect(fx.port));
+    CHECK(late.send(REQ_ws, fx.idle));
+    CHECK(wait_head(fx, late) == "HTTP/1.1 101 Switching Protocols");
+}
+
+static const Test Tests[] = {
+    { "pipeline"          , test_pipeline          },
+    { "parked"            , test_parked            },
+    { "shared_buffers"    , test_shared_buffers    },
+    { "no_malloc"         , test_no_malloc         },
+    { "empty_path"        , test_empty_path        },
+    { "content_length"    , test_content_length    },
+    { "query"             , test_query             },
+    { "chunked"           , test_chunked           },
+    { "body_sink"         , test_body_sink         },
+    { "assets"            , test_assets            },
+    { "files"             , test_files             },
+    { "stream_abort"      , test_stream_abort      },
+    { "slow_download"     , test_slow_download     },
+    { "trickle_download"  , test_trickle_download  },
+    { "stalled_events"    , test_stalled_events    },
+    { "stalled_websocket" , test_stalled_websocket },
+    { "subscriber_cap"    , test_subscriber_cap    },
+    { "ws_accept"         , test_ws_accept         },
+    { "ws_masked"         , test_ws_masked         },
+    { "ws_batch"          , test_ws_batch          },
+};
+
+int main(int argc, char **argv) {
+    for (const auto &v : Tests) {
+        if (argc < 2 || !strcmp(argv[1], v.name)) {
+            printf("%s\n", v.name);
+            v.run();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include <vector>
+
+#include "host.h"
+#include "iomux.h"
+#include "scheduler.h"
+#include "sc16is7xx.h"
+
+struct Test {
+    const char *name;
+    void (*run)();
+};
+
+static int                     Runs = 0;
+static std::vector<IomuxEvent> Events;
+
+static void pins_changed(const IomuxEvent &ev) {
+    Events.push_back(ev);
+}
+
+static void pins_task() {
+    Runs++;
+    iomux_service();
+}
+
+/* the pins task, added once as the scheduler has no way to remove it */
+static int pins_task_id() {
+    static int task = sched_event("pins", 0, pins_task);
+    return task;
+}
+
+static void test_pin_interrupt() {
+    HostSc16is7xx chip(15, 4);
+    int           task = pins_task_id();
+
+    /* the low nibble drives, the interrupt is on GPIO5 only */
+    iomux_init();
+    CHECK(task >= 0);
+    CHECK(iomux_attach(task, pins_changed));
+    iomux_io_dir(0x0f);
+    iomux_pin_interrupt(5, true);
+    Runs = 0;
+    Events.clear();
+
+    /* a change on a pin without the interrupt enabled does not wake anything */
+    auto before = iomux_stats();
+    chip.input(0x40);
+    CHECK(!chip.irq());
+    sched_run();
+    CHECK(Runs == 0);
+
+    /* the edge pulls IRQ down, the ISR queues its time and wakes the task */
+    uint32_t time = micros();
+    chip.input(0x60);
+    CHECK(chip.irq());
+    CHECK(iomux_stats().irqs == before.irqs);
+
+    /* the event carries the time of the interrupt, not the one of the task */
+    host_advance(100000);
+    sched_run();
+    CHECK(Runs == 1);
+    CHECK(Events.size() == 1);
+    CHECK(Events[0].time - time < 100000);
+    CHECK(Events[0].changed == 0x20);
+    CHECK(Events[0].state == 0x60);
+
+    /* reading IODATA released the line, and the queue was taken */
+    CHECK(!chip.irq());
+    CHECK(iomux_stats().irqs == before.irqs + 1);
+    CHECK(iomux_stats().lost == before.lost);
+
+    /* nothing is left to run */
+    sched_run();
+    CHECK(Runs == 1);
+
+    /* the pin going back is an edge of its own */
+    chip.input(0x40);
+    sched_run();
+    CHECK(Runs == 2);
+    CHECK(Events.size() == 2);
+    CHECK(Events[1].changed == 0x20);
+    CHECK(Events[1].state == 0x40);
+}
+
+static void test_attach_range() {
+    HostSc16is7xx chip(15, 4);
+    int           task = pins_task_id();
+
+    /* ids that are not tasks are refused */
+    iomux_init();
+    CHECK(!iomux_attach(-1, pins_changed));
+    CHECK(!iomux_attach(static_cast<int>(sched_count()), pins_changed));
+    CHECK(!iomux_attach(SCHED_MAX_TASKS, pins_changed));
+
+    /* while an existing one is taken */
+    CHECK(task >= 0);
+    CHECK(iomux_attach(task, pins_changed));
+}
+
+static void test_template() {
+    IoMux<5, 2, 4000000, 1> dev;
+    HostSc16is7xx           main(15);
+    HostSc16is7xx           other(5);
+
+    /* each instance talks to its own chip */
+    iomux_init();
+    dev.init();
+    other.frames = 0;
+    main.frames = 0;
+
+    /* the UART registers of the second instance land on channel 1 */
+    dev.uart_begin(9600);
+    CHECK(other.channel(1).dll == 96);
+    CHECK(other.channel(1).dlh == 0);
+    CHECK(other.channel(0).dll == 0);
+    CHECK(main.channel(0).dll == 0);
+    CHECK(main.frames == 0);
+
+    /* the I/O pins are per chip */
+    dev.io_dir(0xff);
+    dev.io_write(0xa5);
+    iomux_io_dir(0xff);
+    iomux_io_write(0x5a);
+    CHECK(other.output() == 0xa5);
+    CHECK(main.output() == 0x5a);
+
+    /* the bus clock follows the instance, one 16-bit frame each */
+    host_spi_reset_stats();
+    dev.io_write(0x00);
+    CHECK(host_spi_stats().ns == 2 * 8000000000ull / 4000000);
+    host_spi_reset_stats();
+    iomux_io_write(0x00);
+    CHECK(host_spi_stats().ns == 2 * 8000000000ull / 20000000);
+}
+
+static const Test Tests[] = {
+    { "pin_interrupt" , test_pin_interrupt },
+    { "attach_range"  , test_attach_range  },
+    { "template"      , test_template      },
+};
+
+int main(int argc, char **argv) {
+    for (const auto &v : Tests) {
+        if (argc < 2 || !strcmp(argv[1], v.name)) {
+            printf("%s\n", v.name);
+            v.run();
+        }
+    }
+    return 0;
+}
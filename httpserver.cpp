@@ -1,3 +1,7 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <bearssl/bearssl_hash.h>
+
 #include "progmem.h"
 #include "httpserver.h"
 
@@ -14,342 +18,2287 @@ static const MethodName Methods[] PROGMEM = {
     { "DELETE" , HttpMethod::DELETE },
 };
 
-static const char *HTTP_400_BAD_REQUEST PROGMEM =
-    "HTTP/1.1 400 Bad Request\r\n"
-    "Content-Length: 12\r\n"
-    "Content-Type: text/plain\r\n"
-    "\r\n"
-    "bad request\n";
-
-static const char *HTTP_404_NOT_FOUND PROGMEM =
-    "HTTP/1.1 404 Not Found\r\n"
-    "Content-Length: 10\r\n"
-    "Content-Type: text/plain\r\n"
-    "\r\n"
-    "not found\n";
-
-static const char *HTTP_405_METHOD_NOT_ALLOWED PROGMEM =
-    "HTTP/1.1 405 Method Not Allowed\r\n"
-    "Content-Length: 19\r\n"
-    "Content-Type: text/plain\r\n"
-    "\r\n"
-    "method not allowed\n";
-
-static const char *HTTP_413_PAYLOAD_TOO_LARGE PROGMEM =
-    "HTTP/1.1 413 Payload Too Large\r\n"
-    "Content-Length: 18\r\n"
-    "Content-Type: text/plain\r\n"
-    "\r\n"
-    "payload too large\n";
-
-static const char *HTTP_500_INTERNAL_SERVER_ERROR PROGMEM =
-    "HTTP/1.1 500 Internal Server Error\r\n"
-    "Content-Length: 22\r\n"
-    "Content-Type: text/plain\r\n"
-    "\r\n"
-    "internal server error\n";
-
-static const char *HTTP_501_NOT_IMPLEMENTED PROGMEM =
-    "HTTP/1.1 501 Not Implemented\r\n"
-    "Content-Length: 16\r\n"
-    "Content-Type: text/plain\r\n"
-    "\r\n"
-    "not implemented\n";
-
-HttpServer::HttpServer(uint16_t port, const HttpRoutingTable *routes) : _srv(port), _routes(routes) {
-    _req.headers.reserve(sizeof(_headers) / sizeof(_headers[0]));
-}
+struct MimeType {
+    char ext[6];
+    char type[24];
+};
 
-void HttpServer::poll() {
-    auto conn = _srv.available();
-    auto state = conn.connected();
+static const MimeType MimeTab[] PROGMEM = {
+    { "htm"  , "text/html"              },
+    { "html" , "text/html"              },
+    { "css"  , "text/css"               },
+    { "js"   , "text/javascript"        },
+    { "json" , "application/json"       },
+    { "txt"  , "text/plain"             },
+    { "log"  , "text/plain"             },
+    { "csv"  , "text/csv"               },
+    { "svg"  , "image/svg+xml"          },
+    { "png"  , "image/png"              },
+    { "jpg"  , "image/jpeg"             },
+    { "ico"  , "image/x-icon"           },
+    { "gz"   , "application/gzip"       },
+};
 
-    /* handle new connections (one at a time) */
-    if (state && accept(std::move(conn))) {
-        _state = State::ReadHeaders;
-    }
+struct HeaderName {
+    uint32_t     hash;
+    HttpHeaderId id;
+    char         name[24];
+};
 
-    /* main state machine */
-    switch (_state) {
-        case State::Idle          : break;
-        case State::Finished      : state_finished(); break;
-        case State::ReadHeaders   : state_read_headers(); break;
-        case State::ReadPayload   : state_read_payload(); break;
-        case State::WriteResponse : state_write_response(); break;
-        case State::HandleRequest : state_handle_request(); break;
+/* FNV-1a over the lower-cased name */
+static constexpr uint32_t header_hash(const char *name, size_t len, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ static_cast<byte>(name[i] >= 'A' && name[i] <= 'Z' ? name[i] + 32 : name[i])) * 16777619u;
     }
+    return hash;
 }
 
-void HttpServer::begin() {
-    _srv.setNoDelay(true);
-    _srv.begin();
+#define HEADER(name, id)    { header_hash(name, sizeof(name) - 1), HttpHeaderId::id, name }
+
+static const HeaderName Headers[HTTP_KNOWN_HEADERS] PROGMEM = {
+    HEADER( "accept"                , Accept              ),
+    HEADER( "accept-encoding"       , AcceptEncoding      ),
+    HEADER( "connection"            , Connection          ),
+    HEADER( "content-length"        , ContentLength       ),
+    HEADER( "content-type"          , ContentType         ),
+    HEADER( "host"                  , Host                ),
+    HEADER( "if-none-match"         , IfNoneMatch         ),
+    HEADER( "if-range"              , IfRange             ),
+    HEADER( "range"                 , Range               ),
+    HEADER( "sec-websocket-key"     , SecWebSocketKey     ),
+    HEADER( "sec-websocket-version" , SecWebSocketVersion ),
+    HEADER( "transfer-encoding"     , TransferEncoding    ),
+    HEADER( "upgrade"               , Upgrade             ),
+};
+
+#undef HEADER
+
+struct StatusText {
+    uint16_t code;
+    char     text[22];
+};
+
+static const StatusText StatusTab[] PROGMEM = {
+    { 101, "Switching Protocols"   },
+    { 200, "OK"                    },
+    { 201, "Created"               },
+    { 204, "No Content"            },
+    { 206, "Partial Content"       },
+    { 304, "Not Modified"          },
+    { 400, "Bad Request"           },
+    { 404, "Not Found"             },
+    { 405, "Method Not Allowed"    },
+    { 406, "Not Acceptable"        },
+    { 409, "Conflict"              },
+    { 411, "Length Required"       },
+    { 413, "Payload Too Large"     },
+    { 416, "Range Not Satisfiable" },
+    { 500, "Internal Server Error" },
+    { 501, "Not Implemented"       },
+    { 503, "Service Unavailable"   },
+};
+
+static const char HTTP_HEAD[] PROGMEM =
+    "HTTP/1.1 %u %s\r\n"
+    "Server: feel-better-soon/1.0\r\n"
+    "Content-Type: %s\r\n"
+    "Content-Length: %u\r\n"
+    "%s"
+    "\r\n";
+
+static const char HTTP_CLOSE[] PROGMEM = "Connection: close\r\n";
+static const char HTTP_RANGE[] PROGMEM = "Accept-Ranges: bytes\r\n";
+static const char HTTP_PART[]  PROGMEM = "Accept-Ranges: bytes\r\nContent-Range: bytes %u-%u/%u\r\n";
+static const char HTTP_NORNG[] PROGMEM = "Content-Range: bytes */%u\r\n";
+static const char HTTP_ETAG[]  PROGMEM = "ETag: %s\r\nCache-Control: no-cache\r\n%s";
+static const char HTTP_GZIP[]  PROGMEM = "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+static const char TEXT_PLAIN[] PROGMEM = "text/plain";
+static const char OCTET_STREAM[] PROGMEM = "application/octet-stream";
+
+static const char HTTP_CHUNKED_HEADER[] PROGMEM =
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n";
+
+static const char HTTP_CHUNKED_TRAILER[] PROGMEM =
+    "0\r\n"
+    "\r\n";
+
+static const char HTTP_EVENT_STREAM_HEADER[] PROGMEM =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char HTTP_WS_GUID[] PROGMEM = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char HTTP_WS_HEADER[] PROGMEM =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Accept: %s\r\n"
+    "\r\n";
+
+enum WsOpcode : byte {
+    WS_CONT   = 0x00,
+    WS_TEXT   = 0x01,
+    WS_BINARY = 0x02,
+    WS_CLOSE  = 0x08,
+    WS_PING   = 0x09,
+    WS_PONG   = 0x0a,
+};
+
+enum WsStatus : uint16_t {
+    WS_NORMAL       = 1000,
+    WS_PROTOCOL     = 1002,
+    WS_UNSUPPORTED  = 1003,
+    WS_TOO_BIG      = 1009,
+};
+
+/* room reserved for the chunk size line ("XXXX\r\n") and the trailing CRLF */
+static constexpr size_t CHUNK_HEAD = 6;
+static constexpr size_t CHUNK_TAIL = 2;
+
+static constexpr uint16_t ROUTE_NIL = 0xffff;
+
+enum RangeKind : byte {
+    RANGE_NONE,
+    RANGE_PARTIAL,
+    RANGE_UNSATISFIABLE,
+};
+
+static bool status_text(char *buf, size_t len, uint16_t code) {
+    for (const auto &v : StatusTab) {
+        if (pgm_read_word(&v.code) == code) {
+            strncpy_P(buf, v.text, len);
+            return true;
+        }
+    }
+    return false;
 }
 
-void HttpServer::close() {
-    WiFiClient::stopAll();
-    _srv.close();
+static bool is_space(char ch) {
+    return ch == ' ' || ch == '\t';
 }
 
-bool HttpServer::accept(WiFiClient conn) {
-    if (_state != State::Idle) {
-        conn.stop();
-        return false;
-    } else {
-        _conn = std::move(conn);
-        _conn.keepAlive(10, 3, 5);
-        return true;
+static const char *mime_type(const char *name) {
+    const char *ext = strrchr(name, '.');
+
+    /* no extension */
+    if (ext == nullptr) {
+        return OCTET_STREAM;
     }
-}
 
-void HttpServer::respond(HttpResponse &&resp) {
-    if (_state != State::WriteResponse) {
-        _resp = std::move(resp);
-        _state = State::WriteResponse;
+    /* search for the extension */
+    for (const auto &v : MimeTab) {
+        if (!strcasecmp_P(ext + 1, v.ext)) {
+            return v.type;
+        }
     }
-}
 
-void HttpServer::state_finished() {
-    _conn.stop();
-    _resp = nullptr;
-    _state = State::Idle;
-    _read_len = 0;
+    /* unknown extension */
+    return OCTET_STREAM;
 }
 
-void HttpServer::state_read_headers() {
-    bool         ok           = false;
-    int          pos          = -1;
-    const char * path         = nullptr;
-    const char * delim        = nullptr;
-    const char * method       = nullptr;
-    int          subver       = 0;
-    char *       end_ptr      = nullptr;
-    size_t       path_len     = 0;
-    size_t       method_len   = 0;
-    size_t       header_count = sizeof(_headers) / sizeof(_headers[0]);
+static bool parse_size(const char *&p, const char *end, size_t &val) {
+    const char *s = p;
 
-    /* check for buffer size */
-    if (_read_len >= sizeof(_buffer)) {
-        respond(HTTP_413_PAYLOAD_TOO_LARGE);
-        return;
+    /* parse the digits, values that do not fit are rejected */
+    for (val = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (val > (SIZE_MAX - (*p - '0')) / 10) {
+            return false;
+        }
+        val = val * 10 + (*p - '0');
     }
 
-    /* read the remaining bytes */
-    auto rem = sizeof(_buffer) - _read_len;
-    auto ret = _conn.read(&_buffer[_read_len], rem);
+    /* at least one digit is required */
+    return p != s;
+}
 
-    /* check for read size */
-    if (ret == 0) {
-        return;
+static RangeKind parse_range(std::string_view val, size_t size, size_t &beg, size_t &end) {
+    size_t      a;
+    size_t      b;
+    const char *p = val.data();
+    const char *e = val.data() + val.size();
+
+    /* only a single byte range is supported, anything else is served in whole */
+    if (val.size() < 6 || strncasecmp(p, "bytes=", 6) != 0 || memchr(p, ',', val.size()) != nullptr) {
+        return RANGE_NONE;
     }
 
-    /* update the read pointers */
-    _last_len = _read_len;
-    _read_len += ret;
+    /* skip the unit */
+    for (p += 6; p < e && is_space(*p);) {
+        p++;
+    }
 
-    /* parse the request */
-    _header_len = phr_parse_request(
-        _buffer,
-        _read_len,
-        &method,
-        &method_len,
-        &path,
-        &path_len,
-        &subver,
-        _headers,
-        &header_count,
-        _last_len
-    );
+    /* suffix range, the last `b` bytes */
+    if (p < e && *p == '-') {
+        if (!parse_size(++p, e, b)) {
+            return RANGE_NONE;
+        } else if (b == 0 || size == 0) {
+            return RANGE_UNSATISFIABLE;
+        } else {
+            a = b < size ? size - b : 0;
+            b = size - 1;
+        }
+    } else {
+        if (!parse_size(p, e, a) || p == e || *p++ != '-') {
+            return RANGE_NONE;
+        }
 
-    /* request incomplete */
-    if (_header_len == -2) {
-        return;
-    }
+        /* the last position is optional */
+        if (!parse_size(p, e, b)) {
+            b = SIZE_MAX;
+        } else if (b < a) {
+            return RANGE_NONE;
+        }
 
-    /* check for header errors */
-    if (_header_len == -1) {
-        respond(HTTP_400_BAD_REQUEST);
-        return;
+        /* the first position must be within the file */
+        if (a >= size) {
+            return RANGE_UNSATISFIABLE;
+        } else {
+            b = std::min(b, size - 1);
+        }
     }
 
-    /* check for unknown errors */
-    if (_header_len <= 0) {
-        respond(HTTP_500_INTERNAL_SERVER_ERROR);
-        return;
+    /* nothing but spaces should follow */
+    while (p < e && is_space(*p)) {
+        p++;
     }
 
-    /* HTTP/1.1 only */
-    if (subver != 1) {
-        respond(HTTP_400_BAD_REQUEST);
-        return;
+    /* check for trailing garbage */
+    if (p != e) {
+        return RANGE_NONE;
     }
 
-    /* clear body and header buffer */
-    _req.body = "";
-    _req.headers.clear();
+    /* the range is inclusive */
+    beg = a;
+    end = b;
+    return RANGE_PARTIAL;
+}
 
-    /* split the query string */
-    if ((delim = strchr(path, '?')) == nullptr) {
-        _req.path  = std::string_view(path, path_len);
-        _req.query = "";
-    } else {
-        _req.path  = std::string_view(path, delim - path);
-        _req.query = std::string_view(delim + 1, path_len - (delim - path) - 1);
+static bool pgm_equal(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (pgm_read_byte(&a[i]) != pgm_read_byte(&b[i])) {
+            return false;
+        }
     }
+    return true;
+}
 
-    /* parse the method */
-    for (const auto &v : Methods) {
-        if (!strncmp_P(method, v.name, method_len) && !pgm_read_byte(&v.name[method_len])) {
-            ok = true;
-            _req.method = static_cast<HttpMethod>(pgm_read_byte(&v.method));
-            break;
+static bool has_token(const char *val, size_t len, const char *token) {
+    size_t i = 0;
+    size_t n = strlen(token);
+
+    /* scan through the comma-separated list */
+    while (i < len) {
+        while (i < len && (val[i] == ' ' || val[i] == '\t' || val[i] == ',')) {
+            i++;
+        }
+
+        /* match the token */
+        size_t p = i;
+        while (i < len && val[i] != ',') {
+            i++;
+        }
+
+        /* strip the trailing spaces */
+        size_t e = i;
+        while (e > p && (val[e - 1] == ' ' || val[e - 1] == '\t')) {
+            e--;
+        }
+
+        /* compare the token */
+        if (e - p == n && !strncasecmp(&val[p], token, n)) {
+            return true;
         }
     }
 
-    /* check for methods */
-    if (!ok) {
-        respond(HTTP_405_METHOD_NOT_ALLOWED);
-        return;
+    /* not found */
+    return false;
+}
+
+static bool accepts_gzip(const char *val, size_t len) {
+    size_t i = 0;
+    bool   r = false;
+
+    /* no "Accept-Encoding" header means any encoding is acceptable */
+    if (val == nullptr) {
+        return true;
     }
 
-    /* build headers */
-    for (int i = 0; i < header_count; i++) {
-        auto name = _headers[i].name;
-        auto nlen = _headers[i].name_len;
+    /* scan through the comma-separated list of "coding;q=x" */
+    while (i < len) {
+        while (i < len && (is_space(val[i]) || val[i] == ',')) {
+            i++;
+        }
 
-        /* add to header buffer */
-        _req.headers.emplace_back(HttpHeader {
-            name  : std::string_view(name, nlen),
-            value : std::string_view(_headers[i].value, _headers[i].value_len),
-        });
-
-        /* find the "Content-Length" header */
-        if (!strncasecmp(name, "content-length", nlen)) {
-            if (pos == -1) {
-                pos = i;
-                continue;
+        /* the coding name */
+        size_t p = i;
+        while (i < len && val[i] != ',' && val[i] != ';' && !is_space(val[i])) {
+            i++;
+        }
+
+        /* only "gzip" and "*" matters */
+        size_t n  = i - p;
+        bool   gz = n == 4 && !strncasecmp(&val[p], "gzip", 4);
+        bool   wc = n == 1 && val[p] == '*';
+
+        /* find the quality value, "q=0", "q=0.0" ... refuses the coding */
+        bool ok = true;
+        while (i < len && val[i] != ',') {
+            if ((val[i] == 'q' || val[i] == 'Q') && i + 2 < len && val[i + 1] == '=' && val[i + 2] == '0') {
+                ok = false;
+                for (i += 3; i < len && val[i] != ',' && !is_space(val[i]); i++) {
+                    if (val[i] != '.' && val[i] != '0') {
+                        ok = true;
+                    }
+                }
             } else {
-                respond(HTTP_400_BAD_REQUEST);
-                return;
+                i++;
             }
         }
 
-        /* "Transfer-Encoding" is not supported */
-        if (!strncasecmp(name, "transfer-encoding", nlen)) {
-            respond(HTTP_501_NOT_IMPLEMENTED);
-            return;
+        /* an explicit "gzip" always takes precedence over "*" */
+        if (gz) {
+            return ok;
+        } else if (wc) {
+            r = ok;
         }
     }
 
-    /* no content length */
-    if (pos == -1) {
-        _state = State::HandleRequest;
-        return;
+    /* only acceptable through the wildcard */
+    return r;
+}
+
+static bool match_etag(const char *val, size_t len, const char *etag) {
+    size_t i = 0;
+    size_t n = strlen_P(etag);
+
+    /* scan through the comma-separated list of entity tags */
+    while (i < len) {
+        while (i < len && (is_space(val[i]) || val[i] == ',')) {
+            i++;
+        }
+
+        /* "*" matches any current representation */
+        if (i < len && val[i] == '*') {
+            return true;
+        }
+
+        /* If-None-Match uses the weak comparison */
+        if (i + 1 < len && val[i] == 'W' && val[i + 1] == '/') {
+            i += 2;
+        }
+
+        /* extract the tag */
+        size_t p = i;
+        while (i < len && val[i] != ',' && !is_space(val[i])) {
+            i++;
+        }
+
+        /* compare with our tag */
+        if (i - p == n && pgm_equal(&val[p], etag, n)) {
+            return true;
+        }
     }
 
-    /* parse the content-length */
-    auto body     = &_buffer[_header_len];
-    auto body_len = strtoul(_headers[pos].value, &end_ptr, 10);
+    /* not found */
+    return false;
+}
 
-    /* check for errors */
-    if (end_ptr - _headers[pos].value != _headers[pos].value_len) {
-        respond(HTTP_400_BAD_REQUEST);
-        return;
+static bool header_id(const char *name, size_t len, HttpHeaderId &id) {
+    uint32_t hash = header_hash(name, len);
+
+    /* the hash rules out almost everything, the name is compared only on a hit */
+    for (const auto &v : Headers) {
+        if (pgm_read_dword(&v.hash) == hash && !strncasecmp_P(name, v.name, len) && !pgm_read_byte(&v.name[len])) {
+            id = static_cast<HttpHeaderId>(pgm_read_byte(&v.id));
+            return true;
+        }
     }
 
-    /* check for payload size */
-    if (_header_len + body_len > sizeof(_buffer)) {
-        respond(HTTP_413_PAYLOAD_TOO_LARGE);
-        return;
+    /* not a well-known header */
+    return false;
+}
+
+static int hex_digit(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    } else if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    } else if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    } else {
+        return -1;
     }
+}
 
-    /* set the body if any */
-    if (body_len != 0) {
-        _req.body = std::string_view(body, body_len);
+static size_t base64_encode(char *out, const byte *buf, size_t len) {
+    size_t       i   = 0;
+    size_t       n   = 0;
+    const char * tab = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    /* encode 3 bytes at a time */
+    for (; i + 2 < len; i += 3) {
+        out[n++] = tab[buf[i] >> 2];
+        out[n++] = tab[((buf[i] & 0x03) << 4) | (buf[i + 1] >> 4)];
+        out[n++] = tab[((buf[i + 1] & 0x0f) << 2) | (buf[i + 2] >> 6)];
+        out[n++] = tab[buf[i + 2] & 0x3f];
     }
 
-    /* check for body length */
-    if (_read_len < body_len + header_count) {
-        _state = State::ReadPayload;
-    } else {
-        _state = State::HandleRequest;
+    /* the remaining 1 or 2 bytes */
+    if (i < len) {
+        out[n++] = tab[buf[i] >> 2];
+        out[n++] = tab[((buf[i] & 0x03) << 4) | (i + 1 < len ? buf[i + 1] >> 4 : 0)];
+        out[n++] = i + 1 < len ? tab[(buf[i + 1] & 0x0f) << 2] : '=';
+        out[n++] = '=';
     }
+
+    /* terminate the string */
+    out[n] = 0;
+    return n;
 }
 
-void HttpServer::state_read_payload() {
-    size_t req = _header_len + _req.body.size();
-    size_t rem = req - _read_len;
+HttpResponse HttpResponse::head(HttpArena &arena, uint16_t code, const char *type, size_t len, const char *headers) {
+    char mime[64];
+    char text[sizeof(StatusTab[0].text)];
+    char head[sizeof(HTTP_HEAD)];
 
-    /* read body bytes if needed */
-    if (rem != 0) {
-        _read_len += _conn.read(&_buffer[_read_len], rem);
+    /* status text and content type are both in PROGMEM */
+    if (!status_text(text, sizeof(text), code)) {
+        text[0] = 0;
     }
 
-    /* check for required size */
-    if (_read_len >= req) {
-        _state = State::HandleRequest;
+    /* copy the content type and the format string */
+    strncpy_P(mime, type, sizeof(mime) - 1);
+    memcpy_P(head, HTTP_HEAD, sizeof(HTTP_HEAD));
+
+    /* build the header, an empty response is returned if the arena is exhausted, the sizes fit the flash */
+    mime[sizeof(mime) - 1] = 0;
+    return borrow(arena.sprintf(head, code, text, mime, static_cast<unsigned>(len), headers));
+}
+
+HttpResponse HttpResponse::error(HttpArena &arena, uint16_t code, const char *headers) {
+    char text[sizeof(StatusTab[0].text)];
+
+    /* the body is the lower-cased status text */
+    if (!status_text(text, sizeof(text), code)) {
+        text[0] = 0;
+    }
+
+    /* convert to lower case */
+    for (char *p = text; *p; p++) {
+        *p = tolower(*p);
     }
+
+    /* build the response */
+    auto body = arena.sprintf("%s\n", text);
+    auto resp = head(arena, code, TEXT_PLAIN, body.size(), headers);
+
+    /* add the body */
+    resp.add(body);
+    return resp;
 }
 
-void HttpServer::state_write_response() {
-    size_t nb = 0;
-    size_t rem = _resp.len;
+HttpResponse HttpResponse::asset(const HttpRequest &req, const HttpAsset &asset) {
+    char etag[24];
+    char fmt[sizeof(HTTP_ETAG)];
+    char enc[sizeof(HTTP_GZIP)];
 
-    /* send the response if any */
-    if (rem != 0) {
-        if (_resp.owned) {
-            nb = _conn.write(_resp.buf, rem);
-        } else {
-            nb = _conn.write_P(_resp.buf, rem);
-        }
+    /* copy the validator and header templates out of flash */
+    strncpy_P(etag, asset.etag, sizeof(etag) - 1);
+    memcpy_P(fmt, HTTP_ETAG, sizeof(HTTP_ETAG));
+    memcpy_P(enc, HTTP_GZIP, sizeof(HTTP_GZIP));
+
+    /* the encoding header only applies to compressed assets */
+    if (!asset.gzip) {
+        enc[0] = 0;
     }
 
-    /* consume the sent bytes */
-    _resp.buf += nb;
-    _resp.len -= nb;
+    /* build the extra headers */
+    etag[sizeof(etag) - 1] = 0;
+    auto hdrs = req.arena->sprintf(fmt, etag, enc);
 
-    /* no more data remains */
-    if (_resp.len == 0) {
-        _state = State::Finished;
+    /* the arena is exhausted */
+    if (hdrs.data() == nullptr) {
+        return HttpResponse(nullptr);
+    }
+
+    /* check if the client copy is still fresh, the length describes the selected representation */
+    auto inm = req.header(HttpHeaderId::IfNoneMatch);
+    if (inm.data() != nullptr && match_etag(inm.data(), inm.size(), asset.etag)) {
+        return head(*req.arena, 304, asset.type, asset.size, hdrs.data());
+    }
+
+    /* compressed assets are only stored in gzip, so there is nothing else to offer */
+    auto acc = req.header(HttpHeaderId::AcceptEncoding);
+    if (asset.gzip && !accepts_gzip(acc.data(), acc.size())) {
+        return error(*req.arena, 406);
     }
+
+    /* build the response */
+    auto resp = head(*req.arena, 200, asset.type, asset.size, hdrs.data());
+    resp.add_P(asset.data, asset.size);
+    return resp;
 }
 
-void HttpServer::state_handle_request() {
-    bool mx   = false;
-    auto rt   = _routes;
-    auto path = _req.path.data();
-    auto size = _req.path.size();
+HttpResponse HttpResponse::file(const HttpRequest &req, fs::File file) {
+    char   fmt[sizeof(HTTP_PART)];
+    size_t beg  = 0;
+    size_t end  = 0;
+    size_t size = file.size();
+    auto   type = mime_type(file.name());
 
-    /* find the handler */
-    for (;;) {
-        auto v0 = pgm_read_byte(rt->path);
-        auto mt = pgm_typed_byte(&rt->method);
+    /* "If-Range" can not be validated since files carry no validators, so it always means the whole file */
+    auto rng  = req.header(HttpHeaderId::Range);
+    auto kind = rng.data() == nullptr || req.header(HttpHeaderId::IfRange).data() != nullptr
+        ? RANGE_NONE
+        : parse_range(rng, size, beg, end);
 
-        /* not found */
-        if (v0 == 0) {
+    /* dispatch by range kind */
+    switch (kind) {
+        case RANGE_NONE: {
+            memcpy_P(fmt, HTTP_RANGE, sizeof(HTTP_RANGE));
+            end = size - 1;
             break;
         }
 
-        /* compare request path */
-        if (strncmp_P(path, rt->path, size) || pgm_read_byte(&rt->path[size])) {
-            rt++;
-            continue;
+        /* only the requested part */
+        case RANGE_PARTIAL: {
+            memcpy_P(fmt, HTTP_PART, sizeof(HTTP_PART));
+            break;
         }
 
-        /* found the handler */
-        if (mt == _req.method) {
-            respond(pgm_typed_ptr(&rt->handler)(_req));
-            return;
+        /* tell the client how large the file is */
+        case RANGE_UNSATISFIABLE: {
+            memcpy_P(fmt, HTTP_NORNG, sizeof(HTTP_NORNG));
+            auto hdrs = req.arena->sprintf(fmt, static_cast<unsigned>(size));
+            return hdrs.data() == nullptr ? HttpResponse(nullptr) : error(*req.arena, 416, hdrs.data());
         }
+    }
+
+    /* build the extra headers */
+    auto len  = end + 1 - beg;
+    auto hdrs = kind == RANGE_NONE
+        ? std::string_view(fmt)
+        : req.arena->sprintf(fmt, static_cast<unsigned>(beg), static_cast<unsigned>(end), static_cast<unsigned>(size));
 
-        /* move to next entry */
-        rt++;
-        mx = true;
+    /* position the file at the first byte to send */
+    if (hdrs.data() == nullptr || !file.seek(beg)) {
+        return HttpResponse(nullptr);
     }
 
-    /* check if path exists */
-    if (!mx) {
-        respond(HTTP_404_NOT_FOUND);
+    /* build the response, the file is sent after the header */
+    auto resp = head(*req.arena, kind == RANGE_NONE ? 200 : 206, type, len, hdrs.data());
+    resp.source = std::move(file);
+    resp.source_len = len;
+    return resp;
+}
+
+HttpResponse HttpResponse::upgrade(HttpWebSocket &ws) {
+    HttpResponse ret(nullptr);
+    ret.websocket = &ws;
+    return ret;
+}
+
+bool HttpWebSocket::write(const void *buf, size_t len) {
+    if (_subs == 0 || _len + len > sizeof(_batch)) {
+        return false;
     } else {
-        respond(HTTP_405_METHOD_NOT_ALLOWED);
+        memcpy(&_batch[_len], buf, len);
+        _len += len;
+        return true;
+    }
+}
+
+HttpResponse HttpResponse::subscribe(HttpEventStream &events) {
+    HttpResponse ret(HTTP_EVENT_STREAM_HEADER, sizeof(HTTP_EVENT_STREAM_HEADER) - 1);
+    ret.events = &events;
+    return ret;
+}
+
+bool HttpEventStream::publish(const char *event, const char *data) {
+    return publish(event, data, strlen(data));
+}
+
+bool HttpEventStream::publish(const char *event, const char *data, size_t len) {
+    size_t      nb   = 0;
+    size_t      ne   = strlen(event);
+    size_t      nl   = std::count(data, data + len, '\n');
+    const char *eol  = nullptr;
+    const char *end  = data + len;
+
+    /* "event: <name>\n" + "data: <line>\n" for every line + "\n" */
+    nb += ne == 0 ? 0 : ne + 8;
+    nb += len - nl + (nl + 1) * 7 + 1;
+
+    /* the event must fit in the ring */
+    if (nb + sizeof(uint16_t) > sizeof(_ring) || nb > UINT16_MAX) {
+        return false;
+    }
+
+    /* evict the oldest events to make room */
+    while (_head - _tail + sizeof(uint16_t) + nb > sizeof(_ring)) {
+        _tail += sizeof(uint16_t) + length(_tail);
+    }
+
+    /* event length, little-endian */
+    char size[2] = {
+        static_cast<char>(nb & 0xff),
+        static_cast<char>(nb >> 8),
+    };
+
+    /* event header */
+    put(size, sizeof(size));
+
+    /* event name */
+    if (ne != 0) {
+        put("event: ", 7);
+        put(event, ne);
+        put("\n", 1);
+    }
+
+    /* event data, one line at a time */
+    for (;;) {
+        eol = std::find(data, end, '\n');
+        put("data: ", 6);
+        put(data, eol - data);
+        put("\n", 1);
+
+        /* move to the next line */
+        if (eol == end) {
+            break;
+        } else {
+            data = eol + 1;
+        }
+    }
+
+    /* end of event */
+    put("\n", 1);
+    return true;
+}
+
+void HttpEventStream::put(const char *buf, size_t len) {
+    while (len != 0) {
+        size_t pos = _head & (sizeof(_ring) - 1);
+        size_t rem = std::min(len, sizeof(_ring) - pos);
+
+        /* copy till the end of ring */
+        memcpy(&_ring[pos], buf, rem);
+        buf += rem;
+        len -= rem;
+        _head += rem;
+    }
+}
+
+uint16_t HttpEventStream::length(uint32_t pos) const {
+    auto lo = static_cast<byte>(_ring[pos & (sizeof(_ring) - 1)]);
+    auto hi = static_cast<byte>(_ring[(pos + 1) & (sizeof(_ring) - 1)]);
+    return lo | (hi << 8);
+}
+
+void *HttpArena::alloc(size_t size) {
+    size_t pos = (_used + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    size_t end = pos + size;
+
+    /* check for arena space */
+    if (end > sizeof(_buf)) {
+        return nullptr;
     }
+
+    /* bump the pointer */
+    _used = end;
+    _peak = std::max(_peak, _used);
+    return &_buf[pos];
+}
+
+std::string_view HttpArena::sprintf(const char *fmt, ...) {
+    va_list args;
+    size_t  rem = sizeof(_buf) - _used;
+
+    /* format into the free space */
+    va_start(args, fmt);
+    int ret = vsnprintf(&_buf[_used], rem, fmt, args);
+    va_end(args);
+
+    /* check for arena space, the string is not kept on failure */
+    if (ret < 0 || static_cast<size_t>(ret) >= rem) {
+        return std::string_view();
+    }
+
+    /* keep the string with its terminator */
+    auto buf = &_buf[_used];
+    _used += ret + 1;
+    _peak = std::max(_peak, _used);
+    return std::string_view(buf, ret);
+}
+
+void HttpStats::record(uint32_t us) {
+    size_t i = us == 0 ? 0 : 31 - __builtin_clz(us);
+    latency[std::min(i, static_cast<size_t>(HTTP_LATENCY_BUCKETS - 1))]++;
+}
+
+uint32_t HttpStats::percentile(uint32_t pct) const {
+    uint32_t sum = 0;
+    uint32_t num = 0;
+
+    /* count the timed requests */
+    for (auto v : latency) {
+        num += v;
+    }
+
+    /* the upper bound of the bucket containing the percentile */
+    for (size_t i = 0; i < HTTP_LATENCY_BUCKETS; i++) {
+        if ((sum += latency[i]) != 0 && static_cast<uint64_t>(sum) * 100 >= static_cast<uint64_t>(num) * pct) {
+            return 2u << i;
+        }
+    }
+
+    /* no requests */
+    return 0;
+}
+
+HttpConnection::HttpConnection() {
+    _req.arena = &_arena;
+}
+
+void HttpConnection::poll() {
+    if (_state == State::Idle) {
+        return;
+    }
+
+    /* drop the connection if the peer has gone away */
+    if (!_conn.connected() && !_conn.available()) {
+        _keep_alive = false;
+        _state = State::Finished;
+    }
+
+    /* reset the peers that stall or trickle, the request is not counted as served */
+    if (overdue()) {
+        _server->_stats.evicted++;
+        _keep_alive = false;
+        _timed = false;
+        _evict = true;
+        _state = State::Finished;
+    }
+
+    /* main state machine */
+    switch (_state) {
+        case State::Idle          : break;
+        case State::Finished      : state_finished(); break;
+        case State::ReadHeaders   : state_read_headers(); break;
+        case State::ReadPayload   : state_read_payload(); break;
+        case State::ReadChunked   : state_read_chunked(); break;
+        case State::WriteFile     : state_write_file(); break;
+        case State::WriteStream   : state_write_stream(); break;
+        case State::WriteEvents   : state_write_events(); break;
+        case State::WriteResponse : state_write_response(); break;
+        case State::WebSocket     : state_websocket(); break;
+        case State::HandleRequest : state_handle_request(); break;
+    }
+}
+
+void HttpConnection::accept(WiFiClient conn) {
+    _conn = std::move(conn);
+    _conn.keepAlive(10, 3, 5);
+    _since = millis();
+    _state = State::ReadHeaders;
+    _requests = 0;
+}
+
+void HttpConnection::accept_request(bool close) {
+    _keep_alive = !close;
+    _timed = true;
+    _started = micros();
+    _server->_stats.requests++;
+
+    /* count the requests served over a reused connection */
+    if (_requests++ != 0) {
+        _server->_stats.reused++;
+    }
+}
+
+bool HttpConnection::overdue() {
+    bool     watch = true;
+    uint32_t now   = millis();
+    uint32_t limit = 0;
+
+    /* requests must arrive in time, responses of any size only have to keep draining, and the long-lived
+     * event streams and WebSockets only while something is queued for them, idle connections time out on their own */
+    switch (_state) {
+        case State::ReadHeaders   : watch = _read_len != 0; limit = HTTP_HEADER_TIMEOUT; break;
+        case State::ReadPayload   : limit = HTTP_BODY_TIMEOUT; break;
+        case State::ReadChunked   : limit = HTTP_BODY_TIMEOUT; break;
+        case State::WriteFile     : break;
+        case State::WriteStream   : break;
+        case State::WriteResponse : break;
+        case State::WriteEvents   : watch = _ev_pos != _ev_stream->_head; break;
+        case State::WebSocket     : watch = _chunk_pos != _chunk_len || _ws_backlog; break;
+        default                   : watch = false; break;
+    }
+
+    /* restart the clocks on state changes, and while there is nothing to wait for */
+    if (!watch || _state != _watched) {
+        _watched = _state;
+        _entered = now;
+        _window = now;
+        _moved = 0;
+        return false;
+    }
+
+    /* the whole state must complete in time */
+    if (limit != 0 && now - _entered >= limit) {
+        return true;
+    }
+
+    /* and must keep moving at some minimum rate */
+    if (now - _window >= HTTP_PROGRESS_WINDOW) {
+        if (_moved < HTTP_MIN_PROGRESS) {
+            return true;
+        }
+
+        /* start the next window */
+        _window = now;
+        _moved = 0;
+    }
+
+    /* still on time */
+    return false;
+}
+
+void HttpConnection::fail(uint16_t code) {
+    char close[sizeof(HTTP_CLOSE)];
+    memcpy_P(close, HTTP_CLOSE, sizeof(HTTP_CLOSE));
+
+    /* the connection can not be reused after an error */
+    _keep_alive = false;
+    respond(HttpResponse::error(_arena, code, close));
+}
+
+void HttpConnection::respond(HttpResponse &&resp) {
+    if (_state == State::WriteResponse) {
+        return;
+    }
+
+    /* subscribers never give their slot back on their own, so one is always left for plain requests */
+    if ((resp.websocket != nullptr || resp.events != nullptr) && _server->subscribers() >= HTTP_MAX_SUBSCRIBERS) {
+        fail(503);
+        return;
+    }
+
+    /* nothing to send, or the handler asked for it, close the connection afterwards */
+    if (resp.close || (resp.count == 0 && resp.websocket == nullptr)) {
+        _keep_alive = false;
+    }
+
+    /* WebSocket handshake */
+    if (resp.websocket != nullptr) {
+        upgrade(*resp.websocket);
+        return;
+    }
+
+    /* start sending the response */
+    _sent = 0;
+    _segment = 0;
+    _resp = std::move(resp);
+    _state = State::WriteResponse;
+
+    /* count the heap buffers handed over by handlers, the only ones the server sees */
+    if (_resp.owned) {
+        _server->_stats.taken++;
+    }
+
+    /* streaming responses start with the "Transfer-Encoding" header */
+    if (_resp.producer != nullptr) {
+        _chunk_end = false;
+        _chunk_pos = 0;
+        _chunk_len = sizeof(HTTP_CHUNKED_HEADER) - 1;
+        memcpy_P(_chunk, HTTP_CHUNKED_HEADER, _chunk_len);
+    }
+}
+
+void HttpConnection::upgrade(HttpWebSocket &ws) {
+    byte             dig[br_sha1_SIZE];
+    char             key[40];
+    br_sha1_context  ctx;
+    size_t           req = _header_len + _req.body.size();
+    std::string_view ver = _req.header(HttpHeaderId::SecWebSocketVersion);
+    std::string_view sec = _req.header(HttpHeaderId::SecWebSocketKey);
+    std::string_view upg = _req.header(HttpHeaderId::Upgrade);
+    std::string_view con = _req.header(HttpHeaderId::Connection);
+
+    /* validate the handshake request */
+    if (_req.method != HttpMethod::GET                  ||
+        sec.size() != 24                                ||
+        ver != "13"                                     ||
+        !has_token(upg.data(), upg.size(), "websocket") ||
+        !has_token(con.data(), con.size(), "upgrade")) {
+        fail(400);
+        return;
+    }
+
+    /* Sec-WebSocket-Accept = base64(sha1(key + GUID)) */
+    br_sha1_init(&ctx);
+    br_sha1_update(&ctx, sec.data(), sec.size());
+    memcpy_P(key, HTTP_WS_GUID, sizeof(HTTP_WS_GUID));
+    br_sha1_update(&ctx, key, sizeof(HTTP_WS_GUID) - 1);
+    br_sha1_out(&ctx, dig);
+    base64_encode(key, dig, sizeof(dig));
+
+    /* stage the handshake response */
+    _chunk_pos = 0;
+    _chunk_len = snprintf_P(_chunk, sizeof(_chunk), HTTP_WS_HEADER, key);
+
+    /* keep whatever the client sent after the handshake, the buffer only if there is some */
+    memmove(_buffer, &_buffer[req], _read_len - req);
+    _read_len -= req;
+    if (_read_len == 0) {
+        return_buffer();
+    }
+
+    /* attach to the channel */
+    _ws = &ws;
+    _ws->_subs++;
+    _ws_closing = false;
+    _ws_backlog = false;
+    _keep_alive = false;
+    _timed = false;
+    _state = State::WebSocket;
+}
+
+bool HttpConnection::borrow_buffer() {
+    if (_buffer == nullptr) {
+        _buffer = _server->borrow();
+    }
+    return _buffer != nullptr;
+}
+
+void HttpConnection::return_buffer() {
+    if (_buffer != nullptr) {
+        _server->give_back(_buffer);
+        _buffer = nullptr;
+    }
+}
+
+bool HttpConnection::flush_chunk() {
+    size_t rem = _chunk_len - _chunk_pos;
+    size_t ret = rem == 0 ? 0 : _conn.write(&_chunk[_chunk_pos], rem);
+
+    /* check if everything was sent */
+    _moved += ret;
+    _chunk_pos += ret;
+    return _chunk_pos == _chunk_len;
+}
+
+void HttpConnection::produce_chunk() {
+    char   buf[8];
+    size_t cap = sizeof(_chunk) - CHUNK_HEAD - CHUNK_TAIL;
+    size_t win = _conn.availableForWrite();
+
+    /* try to fit the chunk into the send window */
+    if (win > CHUNK_HEAD + CHUNK_TAIL && win - CHUNK_HEAD - CHUNK_TAIL < cap) {
+        cap = win - CHUNK_HEAD - CHUNK_TAIL;
+    }
+
+    /* pull the body from the producer */
+    auto len = _resp.producer(_resp.ctx, &_chunk[CHUNK_HEAD], cap);
+
+    /* the producer gave up, the missing last chunk tells the client the body is incomplete */
+    if (len == HTTP_STREAM_ABORT) {
+        _keep_alive = false;
+        _chunk_end = true;
+        _chunk_pos = 0;
+        _chunk_len = 0;
+        return;
+    }
+
+    /* end of body, stage the last chunk */
+    if (len == 0) {
+        _chunk_end = true;
+        _chunk_pos = 0;
+        _chunk_len = sizeof(HTTP_CHUNKED_TRAILER) - 1;
+        memcpy_P(_chunk, HTTP_CHUNKED_TRAILER, _chunk_len);
+        return;
+    }
+
+    /* put the chunk size right before the data */
+    auto ret = snprintf(buf, sizeof(buf), "%x\r\n", static_cast<unsigned>(len));
+    _chunk_pos = CHUNK_HEAD - ret;
+    _chunk_len = CHUNK_HEAD + len + CHUNK_TAIL;
+    memcpy(&_chunk[_chunk_pos], buf, ret);
+    memcpy(&_chunk[CHUNK_HEAD + len], "\r\n", CHUNK_TAIL);
+}
+
+void HttpConnection::state_finished() {
+    size_t req = _header_len + _req.body.size();
+    size_t rem = _read_len - req;
+
+    /* detach from the WebSocket channel */
+    if (_ws != nullptr) {
+        _ws->_subs--;
+        _ws = nullptr;
+    }
+
+    /* the request is done, long-lived streams have been excluded already */
+    if (_timed) {
+        _timed = false;
+        _server->_stats.record(micros() - _started);
+    }
+
+    /* release the response and everything allocated for the request */
+    _resp = nullptr;
+    _last_len = 0;
+    _arena.reset();
+    _server->_stats.arena = std::max(_server->_stats.arena, static_cast<uint32_t>(_arena.peak()));
+
+    /* close the connection if not persistent, evicted peers get a RST instead of a FIN */
+    if (!_keep_alive) {
+        if (!_evict) {
+            _conn.stop();
+        } else {
+            _conn.abort();
+        }
+
+        /* the slot is free again */
+        return_buffer();
+        _evict = false;
+        _state = State::Idle;
+        _read_len = 0;
+        return;
+    }
+
+    /* carry the pipelined bytes over to the next request, or park without a buffer */
+    if (rem != 0) {
+        memmove(_buffer, &_buffer[req], rem);
+    } else {
+        return_buffer();
+    }
+
+    /* wait for the next request */
+    _since = millis();
+    _state = State::ReadHeaders;
+    _read_len = rem;
+}
+
+void HttpConnection::state_read_headers() {
+    bool         ok           = false;
+    bool         close        = false;
+    bool         chunked      = false;
+    int          pos          = -1;
+    const char * path         = nullptr;
+    const char * delim        = nullptr;
+    const char * method       = nullptr;
+    int          subver       = 0;
+    size_t       path_len     = 0;
+    size_t       method_len   = 0;
+    size_t       header_count = HTTP_MAX_HEADERS;
+
+    /* parked connections borrow a buffer once the next request arrives, it waits in the socket while there is none,
+     * and idle ones are closed */
+    if (_buffer == nullptr) {
+        if (!_conn.available()) {
+            if (millis() - _since >= HTTP_KEEPALIVE_TIMEOUT) {
+                _keep_alive = false;
+                _state = State::Finished;
+            }
+            return;
+        } else if (!borrow_buffer()) {
+            return;
+        }
+    }
+
+    /* check for buffer size */
+    if (_read_len >= HTTP_BUFFER_SIZE) {
+        fail(413);
+        return;
+    }
+
+    /* read the remaining bytes */
+    auto rem = HTTP_BUFFER_SIZE - _read_len;
+    auto ret = _conn.read(&_buffer[_read_len], rem);
+
+    /* nothing new, and no pipelined bytes left to parse */
+    if (ret <= 0 && _read_len == _last_len) {
+        if (_read_len == 0) {
+            return_buffer();
+        }
+        return;
+    }
+
+    /* update the read pointer */
+    if (ret > 0) {
+        _moved += ret;
+        _read_len += ret;
+    }
+
+    /* close the connection on errors unless told otherwise */
+    _keep_alive = false;
+
+    /* parse the request */
+    uint32_t cycles = ESP.getCycleCount();
+    _header_len = phr_parse_request(
+        _buffer,
+        _read_len,
+        &method,
+        &method_len,
+        &path,
+        &path_len,
+        &subver,
+        _server->_headers,
+        &header_count,
+        _last_len
+    );
+
+    /* bytes left over from a partial parse are rescanned, but only counted once */
+    _server->_stats.parse_cycles += ESP.getCycleCount() - cycles;
+    _server->_stats.parse_bytes += _read_len - _last_len;
+
+    /* request incomplete */
+    if (_header_len == -2) {
+        _last_len = _read_len;
+        return;
+    }
+
+    /* check for header errors */
+    if (_header_len == -1) {
+        fail(400);
+        return;
+    }
+
+    /* check for unknown errors */
+    if (_header_len <= 0) {
+        fail(500);
+        return;
+    }
+
+    /* HTTP/1.1 only */
+    if (subver != 1) {
+        fail(400);
+        return;
+    }
+
+    /* clear body and allocate the header buffer */
+    _req.body = "";
+    _req.headers.len = 0;
+    _req.headers.buf = _arena.alloc<HttpHeader>(header_count);
+
+    /* check for allocation */
+    if (_req.headers.buf == nullptr) {
+        fail(500);
+        return;
+    }
+
+    /* split the query string */
+    if ((delim = static_cast<const char *>(memchr(path, '?', path_len))) == nullptr) {
+        _req.path  = std::string_view(path, path_len);
+        _req.query = "";
+    } else {
+        _req.path  = std::string_view(path, delim - path);
+        _req.query = std::string_view(delim + 1, path_len - (delim - path) - 1);
+    }
+
+    /* a target like "?a" has no path to route or open */
+    if (_req.path.empty()) {
+        fail(400);
+        return;
+    }
+
+    /* parse the method */
+    for (const auto &v : Methods) {
+        if (!strncmp_P(method, v.name, method_len) && !pgm_read_byte(&v.name[method_len])) {
+            ok = true;
+            _req.method = static_cast<HttpMethod>(pgm_read_byte(&v.method));
+            break;
+        }
+    }
+
+    /* check for methods */
+    if (!ok) {
+        fail(405);
+        return;
+    }
+
+    /* build headers, and index the well-known ones */
+    memset(_req.known, 0, sizeof(_req.known));
+    for (int i = 0; i < header_count; i++) {
+        HttpHeaderId id;
+        auto         name = _server->_headers[i].name;
+        auto         nlen = _server->_headers[i].name_len;
+        auto         vbuf = _server->_headers[i].value;
+        auto         vlen = _server->_headers[i].value_len;
+
+        /* add to header buffer */
+        new (&_req.headers.buf[_req.headers.len++]) HttpHeader {
+            name  : std::string_view(name, nlen),
+            value : std::string_view(vbuf, vlen),
+        };
+
+        /* not a well-known header */
+        if (!header_id(name, nlen, id)) {
+            continue;
+        }
+
+        /* the first one wins, but "Content-Length" must be unique */
+        if (_req.known[static_cast<size_t>(id)] == 0) {
+            _req.known[static_cast<size_t>(id)] = i + 1;
+        } else if (id == HttpHeaderId::ContentLength) {
+            fail(400);
+            return;
+        }
+
+        /* headers that affect the framing */
+        switch (id) {
+            default: {
+                break;
+            }
+
+            /* check for "Connection: close" */
+            case HttpHeaderId::Connection: {
+                close |= has_token(vbuf, vlen, "close");
+                break;
+            }
+
+            /* only the "chunked" transfer coding is supported */
+            case HttpHeaderId::TransferEncoding: {
+                if (vlen == 7 && !strncasecmp(vbuf, "chunked", 7)) {
+                    chunked = true;
+                    break;
+                } else {
+                    fail(501);
+                    return;
+                }
+            }
+        }
+    }
+
+    /* locate the "Content-Length" header */
+    pos = _req.known[static_cast<size_t>(HttpHeaderId::ContentLength)] - 1;
+
+    /* route the request now, so that a body sink can take the payload as it arrives */
+    _route = _server->_router.find(_req, _found);
+    _sink  = _route == nullptr ? nullptr : pgm_typed_ptr(&_route->sink);
+    _sink_off = 0;
+
+    /* chunked body, decode it as it arrives */
+    if (chunked) {
+        if (pos != -1) {
+            fail(400);
+            return;
+        } else {
+            _chunked = {};
+            _chunked.consume_trailer = 1;
+            _req.body = std::string_view(&_buffer[_header_len], 0);
+            accept_request(close);
+            _state = State::ReadChunked;
+            return;
+        }
+    }
+
+    /* no content length */
+    if (pos == -1) {
+        accept_request(close);
+        _state = State::HandleRequest;
+        return;
+    }
+
+    /* parse the content-length, plain digits only */
+    auto   body     = &_buffer[_header_len];
+    auto   body_ptr = _server->_headers[pos].value;
+    auto   body_end = body_ptr + _server->_headers[pos].value_len;
+    size_t body_len = 0;
+
+    /* check for errors */
+    if (!parse_size(body_ptr, body_end, body_len) || body_ptr != body_end) {
+        fail(400);
+        return;
+    }
+
+    /* streamed body, hand over what has already arrived */
+    if (_sink != nullptr) {
+        accept_request(close);
+        _sink_len = body_len;
+        _state = State::ReadPayload;
+        drain_body(std::min(body_len, _read_len - _header_len));
+        return;
+    }
+
+    /* check for payload size */
+    if (body_len > HTTP_BUFFER_SIZE - _header_len) {
+        fail(413);
+        return;
+    }
+
+    /* set the body if any */
+    if (body_len != 0) {
+        _req.body = std::string_view(body, body_len);
+    }
+
+    /* HTTP/1.1 connections are persistent by default */
+    accept_request(close);
+
+    /* check for body length */
+    if (_read_len < _header_len + body_len) {
+        _state = State::ReadPayload;
+    } else {
+        _state = State::HandleRequest;
+    }
+}
+
+void HttpConnection::state_read_payload() {
+    size_t req = _header_len + _req.body.size();
+    size_t rem = req - _read_len;
+
+    /* streamed body, read no more than the body into the space after the header */
+    if (_sink != nullptr) {
+        if (_sink_len != 0) {
+            auto ret = _conn.read(&_buffer[_read_len], std::min(_sink_len, HTTP_BUFFER_SIZE - _read_len));
+            _moved += ret;
+            _read_len += ret;
+            drain_body(_read_len - _header_len);
+        }
+        return;
+    }
+
+    /* read body bytes if needed */
+    if (rem != 0) {
+        auto ret = _conn.read(&_buffer[_read_len], rem);
+        _moved += ret;
+        _read_len += ret;
+    }
+
+    /* check for required size */
+    if (_read_len >= req) {
+        _state = State::HandleRequest;
+    }
+}
+
+void HttpConnection::state_read_chunked() {
+    size_t pos = _header_len + _req.body.size();
+    size_t rem = _read_len - pos;
+
+    /* read more bytes once everything has been decoded */
+    if (rem == 0) {
+        if (_read_len >= HTTP_BUFFER_SIZE) {
+            fail(413);
+            return;
+        }
+
+        /* read the remaining bytes */
+        auto ret = _conn.read(&_buffer[_read_len], HTTP_BUFFER_SIZE - _read_len);
+
+        /* check for read size */
+        if (ret <= 0) {
+            return;
+        }
+
+        /* update the read pointers */
+        rem = ret;
+        _moved += ret;
+        _read_len += ret;
+    }
+
+    /* decode the chunks in place, right after the decoded body */
+    auto len = rem;
+    auto ret = phr_decode_chunked(&_chunked, &_buffer[pos], &len);
+
+    /* check for chunk errors */
+    if (ret == -1) {
+        fail(400);
+        return;
+    }
+
+    /* streamed body, the decoded bytes are handed over, and the pipelined ones are kept */
+    if (_sink != nullptr) {
+        _read_len = pos + len + std::max(ret, static_cast<ssize_t>(0));
+        _sink_len = ret == -2 ? SIZE_MAX : len;
+        drain_body(len);
+        return;
+    }
+
+    /* extend the body with the decoded bytes */
+    _read_len = pos + len;
+    _req.body = std::string_view(_req.body.data(), _req.body.size() + len);
+
+    /* body incomplete */
+    if (ret == -2) {
+        return;
+    }
+
+    /* the decoder leaves the pipelined bytes right after the body */
+    _read_len += ret;
+    _state = State::HandleRequest;
+}
+
+bool HttpConnection::drain_body(size_t len) {
+    auto buf = &_buffer[_header_len];
+    auto rem = _read_len - _header_len - len;
+
+    /* hand the bytes right after the header to the sink */
+    if (len != 0 && !_sink(_req, _sink_off, buf, len)) {
+        _sink = nullptr;
+        _keep_alive = false;
+        _read_len = _header_len;
+        _state = State::HandleRequest;
+        return false;
+    }
+
+    /* move the remaining bytes over the consumed ones */
+    memmove(buf, &buf[len], rem);
+    _read_len -= len;
+    _sink_off += len;
+    _sink_len -= len;
+
+    /* the whole body was handed over */
+    if (_sink_len == 0) {
+        _state = State::HandleRequest;
+    }
+
+    /* keep draining */
+    return true;
+}
+
+void HttpConnection::state_write_response() {
+    while (_segment < _resp.count) {
+        size_t nb  = 0;
+        auto & seg = _resp.segs[_segment];
+
+        /* send the segment */
+        if (seg.progmem) {
+            nb = _conn.write_P(&seg.buf[_sent], seg.len - _sent);
+        } else {
+            nb = _conn.write(&seg.buf[_sent], seg.len - _sent);
+        }
+
+        /* consume the sent bytes, the buffer itself must stay intact for free() */
+        _moved += nb;
+        if ((_sent += nb) != seg.len) {
+            return;
+        }
+
+        /* move to the next segment */
+        _sent = 0;
+        _segment++;
+    }
+
+    /* file response, staged through the chunk buffer */
+    if (_resp.source_len != 0) {
+        _chunk_pos = 0;
+        _chunk_len = 0;
+        _state = State::WriteFile;
+        return;
+    }
+
+    /* streaming response */
+    if (_resp.producer != nullptr) {
+        _state = State::WriteStream;
+        return;
+    }
+
+    /* plain response */
+    if (_resp.events == nullptr) {
+        _state = State::Finished;
+        return;
+    }
+
+    /* event subscription, starting with the next published event, anything the client sends is ignored */
+    return_buffer();
+    _read_len = 0;
+    _timed = false;
+    _ev_off = 0;
+    _ev_pos = _resp.events->_head;
+    _ev_stream = _resp.events;
+    _keep_alive = false;
+    _state = State::WriteEvents;
+}
+
+void HttpConnection::state_write_file() {
+    for (;;) {
+        if (!flush_chunk()) {
+            return;
+        }
+
+        /* the whole file was sent */
+        if (_resp.source_len == 0) {
+            _state = State::Finished;
+            return;
+        }
+
+        /* read no more than the send window can take right now */
+        size_t win = _conn.availableForWrite();
+        size_t len = std::min(std::min(win, sizeof(_chunk)), _resp.source_len);
+
+        /* stop if there is no more room in the send window */
+        if (len == 0) {
+            return;
+        }
+
+        /* read the next piece */
+        _chunk_pos = 0;
+        _chunk_len = _resp.source.read(reinterpret_cast<uint8_t *>(_chunk), len);
+
+        /* the file was truncated under us, the promised length can not be kept */
+        if (_chunk_len == 0) {
+            _keep_alive = false;
+            _state = State::Finished;
+            return;
+        }
+
+        /* consume the read bytes */
+        _resp.source_len -= _chunk_len;
+    }
+}
+
+void HttpConnection::state_write_stream() {
+    for (;;) {
+        if (!flush_chunk()) {
+            return;
+        }
+
+        /* the last chunk was sent */
+        if (_chunk_end) {
+            _state = State::Finished;
+            return;
+        }
+
+        /* stop if there is no more room in the send window */
+        if (_conn.availableForWrite() == 0) {
+            return;
+        }
+
+        /* stage the next chunk */
+        produce_chunk();
+    }
+}
+
+void HttpConnection::state_write_events() {
+    auto   es   = _ev_stream;
+    size_t mask = sizeof(es->_ring) - 1;
+
+    /* send as much as the send window allows */
+    for (;;) {
+        if (static_cast<int32_t>(_ev_pos - es->_tail) < 0) {
+            if (_ev_off != 0) {
+                _server->_stats.dropped++;
+                _state = State::Finished;
+                return;
+            } else {
+                _server->_stats.skipped++;
+                _ev_pos = es->_tail;
+            }
+        }
+
+        /* no more events */
+        if (_ev_pos == es->_head) {
+            return;
+        }
+
+        /* locate the unsent part of the current event */
+        size_t len = es->length(_ev_pos);
+        size_t pos = (_ev_pos + sizeof(uint16_t) + _ev_off) & mask;
+        size_t rem = std::min(len - _ev_off, mask + 1 - pos);
+        size_t ret = _conn.write(&es->_ring[pos], rem);
+
+        /* move to the next event if fully sent */
+        _moved += ret;
+        if ((_ev_off += ret) == len) {
+            _ev_off = 0;
+            _ev_pos += sizeof(uint16_t) + len;
+        }
+
+        /* send window is full */
+        if (ret != rem) {
+            return;
+        }
+    }
+}
+
+void HttpConnection::state_websocket() {
+    size_t nb = 0;
+
+    /* flush the pending frames first */
+    if (!flush_chunk()) {
+        return;
+    }
+
+    /* the closing handshake is done */
+    if (_ws_closing) {
+        _state = State::Finished;
+        return;
+    }
+
+    /* read the incoming frames, into a buffer borrowed for as long as one is partially received */
+    if (_read_len != HTTP_BUFFER_SIZE && _conn.available() && borrow_buffer()) {
+        auto ret = _conn.read(&_buffer[_read_len], HTTP_BUFFER_SIZE - _read_len);
+        _read_len += ret > 0 ? ret : 0;
+    }
+
+    /* process the complete frames, at most one control reply can be pending */
+    while (!_ws_closing && _chunk_pos == _chunk_len && (nb = ws_frame()) != 0) {
+        memmove(_buffer, &_buffer[nb], _read_len - nb);
+        _read_len -= nb;
+    }
+
+    /* every frame has been processed */
+    if (_read_len == 0) {
+        return_buffer();
+    }
+
+    /* send the control replies if any */
+    flush_chunk();
+}
+
+void HttpConnection::ws_send(byte opcode, const char *buf, size_t len) {
+    size_t nb = 0;
+
+    /* server frames are never masked */
+    if (len < 126) {
+        _chunk[nb++] = 0x80 | opcode;
+        _chunk[nb++] = len;
+    } else {
+        _chunk[nb++] = 0x80 | opcode;
+        _chunk[nb++] = 126;
+        _chunk[nb++] = len >> 8;
+        _chunk[nb++] = len & 0xff;
+    }
+
+    /* stage the frame */
+    memcpy(&_chunk[nb], buf, len);
+    _chunk_pos = 0;
+    _chunk_len = nb + len;
+}
+
+void HttpConnection::ws_close(uint16_t code) {
+    char buf[2] = {
+        static_cast<char>(code >> 8),
+        static_cast<char>(code & 0xff),
+    };
+
+    /* send the close frame and wait for it to be flushed */
+    ws_send(WS_CLOSE, buf, sizeof(buf));
+    _ws_closing = true;
+}
+
+void HttpConnection::ws_batch() {
+    if (_state != State::WebSocket || _ws_closing || _ws->_len == 0) {
+        return;
+    }
+
+    /* skip this batch if the previous frame has not been sent yet */
+    if (_chunk_pos != _chunk_len || _conn.availableForWrite() < _ws->_len + HTTP_WS_FRAME_HEAD) {
+        _server->_stats.skipped++;
+        _ws_backlog = true;
+        return;
+    }
+
+    /* send the batch as a single binary frame */
+    ws_send(WS_BINARY, _ws->_batch, _ws->_len);
+    flush_chunk();
+    _ws_backlog = false;
+}
+
+size_t HttpConnection::ws_frame() {
+    size_t   hl   = 2;
+    uint64_t len  = 0;
+    char *   mask = nullptr;
+    char *   data = nullptr;
+
+    /* frame header */
+    if (_read_len < hl) {
+        return 0;
+    }
+
+    /* FIN, opcode and payload length */
+    auto b0 = static_cast<byte>(_buffer[0]);
+    auto b1 = static_cast<byte>(_buffer[1]);
+
+    /* client frames must be masked */
+    if (!(b1 & 0x80)) {
+        ws_close(WS_PROTOCOL);
+        return 0;
+    }
+
+    /* extended payload length */
+    switch ((len = b1 & 0x7f)) {
+        case 126: hl += 2; break;
+        case 127: hl += 8; break;
+    }
+
+    /* masking key */
+    if (_read_len < (hl += 4)) {
+        return 0;
+    }
+
+    /* decode the extended payload length */
+    if (len >= 126) {
+        len = 0;
+        for (size_t i = 2; i < hl - 4; i++) {
+            len = (len << 8) | static_cast<byte>(_buffer[i]);
+        }
+    }
+
+    /* the whole frame must fit in the buffer */
+    if (len > HTTP_BUFFER_SIZE - hl) {
+        ws_close(WS_TOO_BIG);
+        return 0;
+    }
+
+    /* frame incomplete */
+    if (_read_len < hl + len) {
+        return 0;
+    }
+
+    /* unmask the payload in place */
+    mask = &_buffer[hl - 4];
+    data = &_buffer[hl];
+
+    /* XOR with the masking key */
+    for (size_t i = 0; i < len; i++) {
+        data[i] ^= mask[i & 3];
+    }
+
+    /* fragmented messages are not supported */
+    if (!(b0 & 0x80)) {
+        ws_close(WS_UNSUPPORTED);
+        return 0;
+    }
+
+    /* dispatch by opcode */
+    switch (b0 & 0x0f) {
+        case WS_CONT: {
+            ws_close(WS_UNSUPPORTED);
+            return 0;
+        }
+
+        /* data frames */
+        case WS_TEXT:
+        case WS_BINARY: {
+            if (_ws->_handler != nullptr) {
+                _ws->_handler(*_ws, (b0 & 0x0f) == WS_BINARY, data, len);
+            }
+            break;
+        }
+
+        /* close, echo the status code back */
+        case WS_CLOSE: {
+            if (len >= 2) {
+                ws_close((static_cast<byte>(data[0]) << 8) | static_cast<byte>(data[1]));
+            } else {
+                ws_close(WS_NORMAL);
+            }
+            break;
+        }
+
+        /* ping, reply with the same payload */
+        case WS_PING: {
+            if (len > 125) {
+                ws_close(WS_PROTOCOL);
+            } else {
+                ws_send(WS_PONG, data, len);
+            }
+            break;
+        }
+
+        /* unsolicited pong */
+        case WS_PONG: {
+            break;
+        }
+
+        /* unknown opcodes */
+        default: {
+            ws_close(WS_PROTOCOL);
+            return 0;
+        }
+    }
+
+    /* consume the frame */
+    return hl + len;
+}
+
+void HttpConnection::state_handle_request() {
+    bool mx = _found;
+    auto rt = _route;
+
+    /* found the handler */
+    if (rt != nullptr) {
+        respond(pgm_typed_ptr(&rt->handler)(_req));
+        return;
+    }
+
+    /* fall back to the static files */
+    HttpAsset asset;
+    auto      bundle = _server->_bundle;
+
+    /* only GET is allowed on static files */
+    if (!mx && bundle != nullptr && bundle->find(_req.path, asset)) {
+        if (_req.method == HttpMethod::GET) {
+            respond(HttpResponse::asset(_req, asset));
+            return;
+        } else {
+            mx = true;
+        }
+    }
+
+    /* then the filesystem */
+    if (!mx && _server->_fs != nullptr && _req.method == HttpMethod::GET) {
+        auto file = open_file();
+        if (file) {
+            respond(HttpResponse::file(_req, std::move(file)));
+            return;
+        }
+    }
+
+    /* check if path exists */
+    if (!mx) {
+        respond(HttpResponse::error(_arena, 404));
+    } else {
+        respond(HttpResponse::error(_arena, 405));
+    }
+}
+
+fs::File HttpConnection::open_file() {
+    auto   path = _req.path;
+    bool   dir  = path.back() == '/';
+    size_t size = path.size() + (dir ? sizeof("index.html") : 1);
+    auto   name = _arena.alloc<char>(size);
+
+    /* the arena is exhausted */
+    if (name == nullptr) {
+        return fs::File();
+    }
+
+    /* refuse to leave the filesystem root */
+    for (size_t i = 0; i + 2 <= path.size(); i++) {
+        if (path[i] == '.' && path[i + 1] == '.' && (i == 0 || path[i - 1] == '/') && (i + 2 == path.size() || path[i + 2] == '/')) {
+            return fs::File();
+        }
+    }
+
+    /* directories are served by their index */
+    memcpy(name, path.data(), path.size());
+    strcpy(&name[path.size()], dir ? "index.html" : "");
+
+    /* directories can not be sent */
+    auto file = _server->_fs->open(name, "r");
+    if (file && file.isDirectory()) {
+        file.close();
+    }
+
+    /* an invalid file means not found */
+    return file;
+}
+
+bool HttpBundle::find(std::string_view path, HttpAsset &asset) const {
+    size_t          lo = 0;
+    size_t          hi = count;
+    HttpBundleEntry ent;
+
+    /* binary search over the sorted index */
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        memcpy_P(&ent, &index[mid], sizeof(ent));
+
+        /* compare the common prefix, then the length */
+        int ret = memcmp_P(path.data(), &strings[ent.path], std::min(path.size(), static_cast<size_t>(ent.path_len)));
+        if (ret == 0) {
+            ret = (path.size() > ent.path_len) - (path.size() < ent.path_len);
+        }
+
+        /* found the file */
+        if (ret == 0) {
+            asset.type = &strings[ent.type];
+            asset.etag = &strings[ent.etag];
+            asset.data = &data[ent.offset];
+            asset.size = ent.size;
+            asset.gzip = ent.gzip;
+            return true;
+        }
+
+        /* narrow the range */
+        if (ret < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    /* not found */
+    return false;
+}
+
+std::string_view HttpRequest::param(const char *name) const {
+    size_t n = strlen(name);
+
+    /* parameter names are stored in PROGMEM */
+    for (size_t i = 0; i < param_count; i++) {
+        if (params[i].name.size() == n && !memcmp_P(name, params[i].name.data(), n)) {
+            return params[i].value;
+        }
+    }
+
+    /* not found */
+    return std::string_view();
+}
+
+std::string_view HttpRequest::header(const char *name) const {
+    HttpHeaderId id;
+    size_t       n = strlen(name);
+
+    /* well-known headers are already indexed */
+    if (header_id(name, n, id)) {
+        return header(id);
+    }
+
+    /* search for the header */
+    for (const auto &hdr : headers) {
+        if (hdr.name.size() == n && !strncasecmp(hdr.name.data(), name, n)) {
+            return hdr.value;
+        }
+    }
+
+    /* not found */
+    return std::string_view();
+}
+
+size_t HttpQuery::decode(char *buf, size_t len) {
+    size_t i = 0;
+    size_t n = 0;
+
+    /* the output never outruns the input */
+    while (i < len) {
+        int hi;
+        int lo;
+
+        /* '+' is a space in form encoding */
+        if (buf[i] == '+') {
+            buf[n++] = ' ';
+            i++;
+            continue;
+        }
+
+        /* check for a valid escape */
+        if (buf[i] != '%' || i + 2 >= len || (hi = hex_digit(buf[i + 1])) < 0 || (lo = hex_digit(buf[i + 2])) < 0) {
+            buf[n++] = buf[i++];
+            continue;
+        }
+
+        /* decode the escape */
+        buf[n++] = static_cast<char>((hi << 4) | lo);
+        i += 3;
+    }
+
+    /* the decoded length */
+    return n;
+}
+
+bool HttpQuery::next(std::string_view &name, std::string_view &value) {
+    for (;;) {
+        if (_pos >= _end) {
+            return false;
+        }
+
+        /* find the end of the pair */
+        auto beg = _pos;
+        auto end = static_cast<char *>(memchr(beg, '&', _end - beg));
+
+        /* the last pair */
+        if (end == nullptr) {
+            end = _end;
+        }
+
+        /* skip the separator */
+        _pos = end + 1;
+
+        /* empty pairs like "a=1&&b=2" are skipped */
+        if (end == beg) {
+            continue;
+        }
+
+        /* split the name and value, the value is optional */
+        auto eq = static_cast<char *>(memchr(beg, '=', end - beg));
+
+        /* decode the name and the value in place */
+        if (eq == nullptr) {
+            name  = std::string_view(beg, decode(beg, end - beg));
+            value = std::string_view(end, 0);
+        } else {
+            name  = std::string_view(beg, decode(beg, eq - beg));
+            value = std::string_view(eq + 1, decode(eq + 1, end - eq - 1));
+        }
+
+        /* found one pair */
+        return true;
+    }
+}
+
+HttpRouter::HttpRouter(const HttpRoutingTable *routes) : _routes(routes) {
+    uint16_t nr = 0;
+
+    /* count the routes */
+    while (pgm_typed_ptr(&routes[nr].path) != nullptr) {
+        nr++;
+    }
+
+    /* the root node */
+    _chain.resize(nr, ROUTE_NIL);
+    _nodes.push_back(Node { nullptr, 0, ROUTE_NIL, ROUTE_NIL, ROUTE_NIL, ROUTE_NIL });
+
+    /* build the trie, this happens only once */
+    for (uint16_t i = 0; i < nr; i++) {
+        insert(i, pgm_typed_ptr(&routes[i].path));
+    }
+}
+
+const HttpRoutingTable *HttpRouter::find(HttpRequest &req, bool &found) const {
+    auto path = req.path.data();
+    auto size = req.path.size();
+
+    /* match the path */
+    req.param_count = 0;
+    auto node = match(0, req, path, path + size);
+
+    /* path not found */
+    if (node == ROUTE_NIL) {
+        found = false;
+        return nullptr;
+    }
+
+    /* find the handler with matching method */
+    for (auto i = _nodes[node].route; i != ROUTE_NIL; i = _chain[i]) {
+        if (pgm_typed_byte(&_routes[i].method) == req.method) {
+            found = true;
+            return &_routes[i];
+        }
+    }
+
+    /* path exists but method mismatch */
+    found = true;
+    return nullptr;
+}
+
+void HttpRouter::insert(uint16_t route, const char *path) {
+    char     ch   = 0;
+    size_t   pos  = 0;
+    size_t   end  = 0;
+    uint16_t node = 0;
+
+    /* walk through the segments */
+    while (pgm_read_byte(&path[pos]) == '/') {
+        for (end = ++pos; (ch = pgm_read_byte(&path[end])) != 0 && ch != '/'; end++) {
+            /* find the end of segment */
+        }
+
+        /* trailing slash */
+        if (end == pos && ch == 0) {
+            break;
+        }
+
+        /* descend into the segment */
+        node = child(node, &path[pos], end - pos);
+        pos = end;
+    }
+
+    /* append to the end of the route chain to preserve the table order */
+    if (_nodes[node].route == ROUTE_NIL) {
+        _nodes[node].route = route;
+    } else {
+        auto i = _nodes[node].route;
+        while (_chain[i] != ROUTE_NIL) {
+            i = _chain[i];
+        }
+        _chain[i] = route;
+    }
+}
+
+uint16_t HttpRouter::child(uint16_t node, const char *seg, size_t len) {
+    auto i = ROUTE_NIL;
+    auto p = len >= 2 && pgm_read_byte(&seg[0]) == '{' && pgm_read_byte(&seg[len - 1]) == '}';
+
+    /* parameter segment, stored without the braces */
+    if (p) {
+        if ((i = _nodes[node].param) != ROUTE_NIL) {
+            return i;
+        } else {
+            i = _nodes.size();
+            _nodes[node].param = i;
+            _nodes.push_back(Node { seg + 1, static_cast<uint16_t>(len - 2), ROUTE_NIL, ROUTE_NIL, ROUTE_NIL, ROUTE_NIL });
+            return i;
+        }
+    }
+
+    /* find the existing literal segment */
+    for (i = _nodes[node].child; i != ROUTE_NIL; i = _nodes[i].sibling) {
+        if (_nodes[i].len == len && pgm_equal(_nodes[i].seg, seg, len)) {
+            return i;
+        }
+    }
+
+    /* add a new literal segment */
+    i = _nodes.size();
+    _nodes.push_back(Node { seg, static_cast<uint16_t>(len), ROUTE_NIL, ROUTE_NIL, ROUTE_NIL, _nodes[node].child });
+    _nodes[node].child = i;
+    return i;
+}
+
+uint16_t HttpRouter::match(uint16_t node, HttpRequest &req, const char *path, const char *end) const {
+    auto &nd = _nodes[node];
+    auto ret = ROUTE_NIL;
+
+    /* end of path, or a trailing slash */
+    if (path == end || (path + 1 == end && *path == '/')) {
+        return nd.route == ROUTE_NIL ? ROUTE_NIL : node;
+    }
+
+    /* must be a new segment */
+    if (*path != '/') {
+        return ROUTE_NIL;
+    }
+
+    /* extract the segment */
+    auto seg = path + 1;
+    auto eos = std::find(seg, end, '/');
+    auto len = static_cast<size_t>(eos - seg);
+
+    /* literal segments take precedence */
+    for (auto i = nd.child; i != ROUTE_NIL; i = _nodes[i].sibling) {
+        if (_nodes[i].len == len && !memcmp_P(seg, _nodes[i].seg, len)) {
+            if ((ret = match(i, req, eos, end)) != ROUTE_NIL) {
+                return ret;
+            }
+        }
+    }
+
+    /* no parameter segment, or no room for more */
+    if (nd.param == ROUTE_NIL || len == 0 || req.param_count >= HTTP_MAX_PARAMS) {
+        return ROUTE_NIL;
+    }
+
+    /* capture the parameter */
+    auto &pn = _nodes[nd.param];
+    auto &pv = req.params[req.param_count++];
+
+    /* match the rest of path */
+    pv.name  = std::string_view(pn.seg, pn.len);
+    pv.value = std::string_view(seg, len);
+
+    /* backtrack if not matched */
+    if ((ret = match(nd.param, req, eos, end)) == ROUTE_NIL) {
+        req.param_count--;
+    }
+
+    /* all done */
+    return ret;
+}
+
+HttpServer::HttpServer(uint16_t port, const HttpRoutingTable *routes, const HttpBundle *bundle, fs::FS *fs) :
+    _srv(port),
+    _router(routes),
+    _fs(fs),
+    _bundle(bundle)
+{
+    for (auto &conn : _conns) {
+        conn._server = this;
+    }
+}
+
+void HttpServer::poll() {
+    /* service every connection once, starting from a different one on each round */
+    for (size_t i = 0; i < HTTP_MAX_CONNS; i++) {
+        _conns[(_next + i) % HTTP_MAX_CONNS].poll();
+    }
+
+    /* handle new connections, after the slots that finished on this round have been released */
+    auto conn = _srv.available();
+    auto state = conn.connected();
+    if (state) {
+        accept(std::move(conn));
+    }
+
+    /* send the batched WebSocket frames, one frame per channel per poll */
+    for (auto &v : _conns) {
+        v.ws_batch();
+    }
+
+    /* the batches have been sent to all the subscribers */
+    for (auto &v : _conns) {
+        if (v._ws != nullptr) {
+            v._ws->_len = 0;
+        }
+    }
+
+    /* move to the next connection */
+    _next = (_next + 1) % HTTP_MAX_CONNS;
+}
+
+char *HttpServer::borrow() {
+    for (size_t i = 0; i < HTTP_MAX_BUFFERS; i++) {
+        if (_free & (1u << i)) {
+            _free &= ~(1u << i);
+            return _buffers[i];
+        }
+    }
+
+    /* all the buffers are lent out */
+    _stats.waited++;
+    return nullptr;
+}
+
+void HttpServer::give_back(char *buf) {
+    _free |= 1u << ((buf - _buffers[0]) / HTTP_BUFFER_SIZE);
+}
+
+size_t HttpServer::subscribers() const {
+    size_t ret = 0;
+
+    /* event streams and WebSockets, including the ones still sending their headers */
+    for (auto &v : _conns) {
+        if (v.subscribed()) {
+            ret++;
+        }
+    }
+
+    /* number of slots held */
+    return ret;
+}
+
+void HttpServer::begin() {
+    _srv.setNoDelay(true);
+    _srv.begin();
+}
+
+void HttpServer::close() {
+    WiFiClient::stopAll();
+    _srv.close();
+}
+
+bool HttpServer::accept(WiFiClient conn) {
+    uint32_t         now  = millis();
+    HttpConnection * slot = nullptr;
+
+    /* a free slot, or else the one that has been waiting for a request the longest, unless its next one has just arrived */
+    for (auto &v : _conns) {
+        if (v.idle()) {
+            slot = &v;
+            break;
+        } else if (v.parked() && !v._conn.available() && (slot == nullptr || now - v._since > now - slot->_since)) {
+            slot = &v;
+        }
+    }
+
+    /* close the parked connection, a browser opens a new one when it needs it again */
+    if (slot != nullptr) {
+        if (!slot->idle()) {
+            slot->_keep_alive = false;
+            slot->state_finished();
+        }
+
+        /* take the slot over */
+        slot->accept(std::move(conn));
+        _stats.accepted++;
+        return true;
+    }
+
+    /* all the connection slots are busy with requests */
+    conn.stop();
+    _stats.rejected++;
+    return false;
 }
@@ -1,8 +1,11 @@
 #ifndef __HTTPSERVER_H__
 #define __HTTPSERVER_H__
 
+#include <new>
+#include <cstddef>
 #include <string_view>
 #include <unordered_map>
+#include <FS.h>
 #include <ESP8266WiFi.h>
 
 #include "picohttpparser.h"
@@ -15,34 +18,195 @@ enum class HttpMethod : byte {
     DELETE,
 };
 
+/* headers indexed during parsing, for the O(1) HttpRequest::header() */
+enum class HttpHeaderId : byte {
+    Accept,
+    AcceptEncoding,
+    Connection,
+    ContentLength,
+    ContentType,
+    Host,
+    IfNoneMatch,
+    IfRange,
+    Range,
+    SecWebSocketKey,
+    SecWebSocketVersion,
+    TransferEncoding,
+    Upgrade,
+};
+
+#define HTTP_KNOWN_HEADERS  13
+#define HTTP_MAX_PARAMS     4
+#define HTTP_MAX_SEGMENTS   4
+#define HTTP_ARENA_SIZE     1536
+
 struct HttpHeader {
     std::string_view name;
     std::string_view value;
 };
 
+struct HttpHeaders {
+    size_t       len = 0;
+    HttpHeader * buf = nullptr;
+
+public:
+    bool   empty() const { return len == 0; }
+    size_t size()  const { return len; }
+
+public:
+    const HttpHeader *begin() const { return buf; }
+    const HttpHeader *end()   const { return buf + len; }
+
+public:
+    const HttpHeader &operator[](size_t i) const { return buf[i]; }
+};
+
+/* bump allocator owned by a connection, everything is released when the request finishes */
+class HttpArena {
+    size_t _used = 0;
+    size_t _peak = 0;
+
+private:
+    alignas(std::max_align_t) char _buf[HTTP_ARENA_SIZE] = {};
+
+public:
+    size_t used() const { return _used; }
+    size_t peak() const { return _peak; }
+    void   reset()      { _used = 0; }
+
+public:
+    void *           alloc(size_t size);
+    std::string_view sprintf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+public:
+    template <typename T>
+    T *alloc(size_t count) {
+        return static_cast<T *>(alloc(sizeof(T) * count));
+    }
+};
+
+struct HttpParam {
+    std::string_view name;      // in PROGMEM, points into the route path
+    std::string_view value;
+};
+
 struct HttpRequest {
     HttpMethod              method;
     std::string_view        path;
     std::string_view        body;
     std::string_view        query;
-    std::vector<HttpHeader> headers;
+    HttpHeaders             headers;
+    HttpArena *             arena;
+
+public:
+    size_t    param_count             = 0;
+    HttpParam params[HTTP_MAX_PARAMS] = {};
+
+public:
+    uint8_t known[HTTP_KNOWN_HEADERS] = {};     // 1-based index into `headers`, 0 if absent
+
+public:
+    std::string_view param(const char *name) const;
+    std::string_view header(const char *name) const;
+
+public:
+    std::string_view header(HttpHeaderId id) const {
+        auto i = known[static_cast<size_t>(id)];
+        return i == 0 ? std::string_view() : headers[i - 1].value;
+    }
+};
+
+/* iterates over "a=1&b=2" pairs of a query string or a form body, percent-escapes and '+' are decoded
+ * in place as the pairs are visited, so the request buffer is modified and can only be iterated once */
+class HttpQuery {
+    char *_pos;
+    char *_end;
+
+public:
+    explicit HttpQuery(std::string_view str) :
+        _pos(const_cast<char *>(str.data())),
+        _end(const_cast<char *>(str.data()) + str.size()) {}
+
+public:
+    bool next(std::string_view &name, std::string_view &value);
+
+public:
+    /* returns the decoded length, malformed escapes are kept as is */
+    static size_t decode(char *buf, size_t len);
+};
+
+class HttpWebSocket;
+class HttpEventStream;
+
+/* fills `buf` with at most `len` bytes of body, returns 0 at the end of the body, or HTTP_STREAM_ABORT
+ * when the body can not be finished, which closes the connection without the last chunk */
+typedef size_t (*HttpProducer)(void *ctx, char *buf, size_t len);
+
+struct HttpSegment {
+    size_t       len;
+    const char * buf;
+    bool         progmem;
+};
+
+/* a static file baked into flash by "mkpages.py", every pointer is in PROGMEM */
+struct HttpAsset {
+    const char *    type;
+    const char *    etag;       // quoted strong validator, e.g. "\"0123abcd\""
+    const uint8_t * data;
+    size_t          size;
+    bool            gzip;       // `data` is stored with "Content-Encoding: gzip"
+};
+
+/* one file of an HttpBundle, `path`, `type` and `etag` are offsets of NUL-terminated strings into the pool */
+struct HttpBundleEntry {
+    uint16_t path;
+    uint16_t path_len;
+    uint16_t type;
+    uint16_t etag;
+    uint32_t offset;
+    uint32_t size;
+    bool     gzip;
+};
+
+/* every file packed into a single flash blob by "mkpages.py", the index is sorted by path */
+struct HttpBundle {
+    size_t                  count;
+    const HttpBundleEntry * index;
+    const char *            strings;
+    const uint8_t *         data;
+
+public:
+    bool find(std::string_view path, HttpAsset &asset) const;
 };
 
 struct HttpResponse {
-    size_t       len   = 0;
-    const char * buf   = nullptr;
-    bool         owned = false;
+    size_t       count    = 0;
+    bool         owned    = false;     // the first segment was malloc()ed
+    bool         close    = false;     // the connection is closed once the response is sent
+    void *       ctx      = nullptr;
+    HttpProducer producer = nullptr;
+    HttpSegment  segs[HTTP_MAX_SEGMENTS] = {};
+
+public:
+    fs::File source;                // sent after the segments, already positioned
+    size_t   source_len = 0;
+
+public:
+    HttpWebSocket   *websocket = nullptr;
+    HttpEventStream *events    = nullptr;
 
 private:
-    HttpResponse(const char *buf, size_t len, bool owned) :
-        len   (len),
-        buf   (buf),
-        owned (owned) {}
+    HttpResponse(const char *buf, size_t len, bool owned, bool progmem) : owned(owned) {
+        if (buf != nullptr) {
+            count = 1;
+            segs[0] = HttpSegment { len, buf, progmem };
+        }
+    }
 
 public:
     ~HttpResponse() {
         if (owned) {
-            free(const_cast<char *>(buf));
+            free(const_cast<char *>(segs[0].buf));
         }
     }
 
@@ -56,18 +220,81 @@ public:
 
 public:
     HttpResponse(const char *buf)             : HttpResponse(buf, slen(buf)) {}
-    HttpResponse(const char *buf, size_t len) : HttpResponse(buf, len, false) {}
+    HttpResponse(const char *buf, size_t len) : HttpResponse(buf, len, false, true) {}
     HttpResponse(const byte *buf, size_t len) : HttpResponse(reinterpret_cast<const char *>(buf), len) {}
 
 public:
     static HttpResponse take(const char *buf)             { return take(buf, slen(buf)); }
-    static HttpResponse take(const char *buf, size_t len) { return HttpResponse(buf, len, true); }
+    static HttpResponse take(const char *buf, size_t len) { return HttpResponse(buf, len, true, false); }
+
+public:
+    /* `buf` is in RAM and must outlive the response, e.g. allocated from `HttpRequest::arena` */
+    static HttpResponse borrow(const char *buf, size_t len) { return HttpResponse(buf, len, false, false); }
+    static HttpResponse borrow(std::string_view buf)        { return borrow(buf.data(), buf.size()); }
+
+public:
+    /* builds the status line, "Content-Type" and "Content-Length" headers into `arena`, `type` is in PROGMEM,
+     * `headers` are extra header lines each ending with CRLF, the body is expected to be added afterwards */
+    static HttpResponse head(HttpArena &arena, uint16_t code, const char *type, size_t len, const char *headers = "");
+    static HttpResponse error(HttpArena &arena, uint16_t code, const char *headers = "");
+
+public:
+    /* serves `asset` honoring "If-None-Match" and "Accept-Encoding", replies with 304 when the client
+     * copy is still fresh, and with 406 when the asset is compressed but the client refuses gzip */
+    static HttpResponse asset(const HttpRequest &req, const HttpAsset &asset);
+
+public:
+    /* appends a segment, fails if the response is empty or has no more segment slots */
+    bool add(const char *buf, size_t len, bool progmem) {
+        if (count == 0 || count == HTTP_MAX_SEGMENTS) {
+            return false;
+        } else if (len == 0) {
+            return true;
+        } else {
+            segs[count++] = HttpSegment { len, buf, progmem };
+            return true;
+        }
+    }
+
+public:
+    bool add(std::string_view buf)           { return add(buf.data(), buf.size(), false); }
+    bool add_P(const void *buf, size_t len)  { return add(static_cast<const char *>(buf), len, true); }
+
+public:
+    /* sends `file` with "Content-Length", honoring a single "Range" with 206 or 416, the content type
+     * is guessed from the file name, the file is read in send-window-sized pieces and never buffered */
+    static HttpResponse file(const HttpRequest &req, fs::File file);
+
+public:
+    /* `head` is the status line and headers in PROGMEM without the terminating empty line, the body
+     * is pulled from `producer` and sent with "Transfer-Encoding: chunked", `ctx` must outlive the response */
+    static HttpResponse stream(const char *head, HttpProducer producer, void *ctx = nullptr) {
+        HttpResponse ret(head);
+        ret.ctx = ctx;
+        ret.producer = producer;
+        return ret;
+    }
+
+public:
+    /* upgrades the connection into a "text/event-stream" subscribed to `events` */
+    static HttpResponse subscribe(HttpEventStream &events);
+
+public:
+    /* performs the WebSocket handshake and attaches the connection to `ws` */
+    static HttpResponse upgrade(HttpWebSocket &ws);
 
 public:
     void swap(HttpResponse &other) {
-        std::swap(len, other.len);
-        std::swap(buf, other.buf);
+        std::swap(count, other.count);
+        std::swap(segs, other.segs);
         std::swap(owned, other.owned);
+        std::swap(close, other.close);
+        std::swap(ctx, other.ctx);
+        std::swap(producer, other.producer);
+        std::swap(source, other.source);
+        std::swap(source_len, other.source_len);
+        std::swap(events, other.events);
+        std::swap(websocket, other.websocket);
     }
 
 private:
@@ -80,59 +307,324 @@ private:
     }
 };
 
+/* receives the request body piece by piece, `off` is the body offset of `buf`, returning false stops the
+ * upload, the handler is called after the whole body (or the refusal) and the connection is closed on refusal */
+typedef bool (*HttpBodySink)(const HttpRequest &req, size_t off, const char *buf, size_t len);
+
+/* `path` points to a PROGMEM string, segments like "{id}" match any non-empty segment, routes with
+ * a `sink` get their body streamed to it instead of `HttpRequest::body`, so it is not limited in size */
 struct HttpRoutingTable {
     HttpMethod     method;
-    char           path[256];
+    const char *   path;
     HttpResponse (*handler)(const HttpRequest &);
+    HttpBodySink   sink;
 };
 
-class HttpServer {
+class HttpRouter {
+    struct Node {
+        const char * seg;
+        uint16_t     len;
+        uint16_t     child;
+        uint16_t     param;
+        uint16_t     route;
+        uint16_t     sibling;
+    };
+
+private:
+    std::vector<Node>        _nodes;
+    std::vector<uint16_t>    _chain;
+    const HttpRoutingTable * _routes;
+
+public:
+    explicit HttpRouter(const HttpRoutingTable *routes);
+
+public:
+    const HttpRoutingTable *find(HttpRequest &req, bool &found) const;
+
+private:
+    void     insert(uint16_t route, const char *path);
+    uint16_t child(uint16_t node, const char *seg, size_t len);
+    uint16_t match(uint16_t node, HttpRequest &req, const char *path, const char *end) const;
+};
+
+#define HTTP_MAX_CONNS      4
+#define HTTP_MAX_BUFFERS    2
+#define HTTP_MAX_HEADERS    32
+#define HTTP_BUFFER_SIZE    4096
+#define HTTP_CHUNK_SIZE     512
+
+#define HTTP_KEEPALIVE_TIMEOUT  5000
+#define HTTP_HEADER_TIMEOUT     10000
+#define HTTP_BODY_TIMEOUT       120000
+
+#define HTTP_STREAM_ABORT       SIZE_MAX
+
+#define HTTP_PROGRESS_WINDOW    2000
+#define HTTP_MIN_PROGRESS       128
+#define HTTP_EVENT_RING_SIZE    2048
+
+/* event streams and WebSockets hold a whole connection slot for as long as they last */
+#define HTTP_MAX_SUBSCRIBERS    (HTTP_MAX_CONNS - 1)
+
+#define HTTP_LATENCY_BUCKETS    20
+
+#define HTTP_WS_FRAME_HEAD      4
+#define HTTP_WS_BATCH_SIZE      (HTTP_CHUNK_SIZE - HTTP_WS_FRAME_HEAD)
+
+struct HttpStats {
+    uint32_t accepted = 0;
+    uint32_t rejected = 0;
+    uint32_t requests = 0;
+    uint32_t reused   = 0;
+    uint32_t skipped  = 0;
+    uint32_t dropped  = 0;
+    uint32_t evicted  = 0;
+    uint32_t taken    = 0;     // responses that handed a malloc()ed buffer over through take()
+    uint32_t waited   = 0;     // polls where a request had arrived but every request buffer was lent out
+    uint32_t arena    = 0;
+    uint32_t since    = millis();
+
+public:
+    /* CPU cycles spent in the header parser, and the bytes it was handed for the first time */
+    uint64_t parse_cycles = 0;
+    uint32_t parse_bytes  = 0;
+
+public:
+    /* requests by the log2 of the microseconds from the parsed header to the last byte sent,
+     * event streams and WebSockets are not counted */
+    uint32_t latency[HTTP_LATENCY_BUCKETS] = {};
+
+public:
+    void     record(uint32_t us);
+    uint32_t percentile(uint32_t pct) const;
+};
+
+class HttpEventStream {
+    friend class HttpConnection;
+
+private:
+    static_assert((HTTP_EVENT_RING_SIZE & (HTTP_EVENT_RING_SIZE - 1)) == 0, "ring size must be a power of 2");
+
+private:
+    /* events are stored as a 16-bit length followed by the formatted event,
+     * `_head` and `_tail` are free-running byte sequence numbers */
+    uint32_t _head = 0;
+    uint32_t _tail = 0;
+    char     _ring[HTTP_EVENT_RING_SIZE] = {};
+
+public:
+    bool publish(const char *event, const char *data);
+    bool publish(const char *event, const char *data, size_t len);
+
+private:
+    void     put(const char *buf, size_t len);
+    uint16_t length(uint32_t pos) const;
+};
+
+/* called for every complete text or binary message, `data` is unmasked in place */
+typedef void (*HttpWsHandler)(HttpWebSocket &ws, bool binary, char *data, size_t len);
+
+class HttpWebSocket {
+    friend class HttpServer;
+    friend class HttpConnection;
+
+private:
+    size_t        _len     = 0;
+    size_t        _subs    = 0;
+    HttpWsHandler _handler = nullptr;
+    char          _batch[HTTP_WS_BATCH_SIZE] = {};
+
+public:
+    explicit HttpWebSocket(HttpWsHandler handler = nullptr) : _handler(handler) {}
+
+public:
+    /* appends to the binary frame sent to every subscriber on the next HttpServer::poll() */
+    bool   write(const void *buf, size_t len);
+    size_t subscribers() const { return _subs; }
+};
+
+class HttpServer;
+
+class HttpConnection {
+    friend class HttpServer;
+
+private:
     enum class State {
         Idle,
         Finished,
         ReadHeaders,
         ReadPayload,
+        ReadChunked,
         HandleRequest,
+        WriteFile,
+        WriteStream,
+        WriteEvents,
         WriteResponse,
+        WebSocket,
     };
 
 private:
-    WiFiServer _srv;
     WiFiClient _conn;
 
 private:
-    State  _state      = State::Idle;
-    size_t _last_len   = 0;
-    size_t _read_len   = 0;
-    size_t _header_len = 0;
+    State    _state      = State::Idle;
+    bool     _keep_alive = false;
+    size_t   _last_len   = 0;
+    size_t   _read_len   = 0;
+    size_t   _header_len = 0;
+    size_t   _sent       = 0;
+    size_t   _segment    = 0;
+    uint32_t _since      = 0;
+    uint32_t _requests   = 0;
+    uint32_t _started    = 0;
+    bool     _timed      = false;
+
+private:
+    /* deadline and minimum progress bookkeeping of the current state, reads have a deadline,
+     * writes only have to keep moving, `_moved` counts the bytes read or written since `_window` */
+    State    _watched = State::Idle;
+    uint32_t _entered = 0;
+    uint32_t _window  = 0;
+    size_t   _moved   = 0;
+    bool     _evict   = false;
+
+private:
+    phr_chunked_decoder _chunked = {};
+
+private:
+    bool                     _found    = false;
+    const HttpRoutingTable * _route    = nullptr;
+    HttpBodySink             _sink     = nullptr;
+    size_t                   _sink_off = 0;
+    size_t                   _sink_len = 0;
+
+private:
+    bool   _chunk_end               = false;
+    size_t _chunk_pos               = 0;
+    size_t _chunk_len               = 0;
+    char   _chunk[HTTP_CHUNK_SIZE]  = {};
+
+private:
+    bool            _ws_closing = false;
+    bool            _ws_backlog = false;    // a batch was skipped since the last frame went out
+    HttpWebSocket * _ws         = nullptr;
+
+private:
+    uint16_t          _ev_off    = 0;
+    uint32_t          _ev_pos    = 0;
+    HttpEventStream * _ev_stream = nullptr;
 
 private:
-    char       _buffer[4096] = {};
-    phr_header _headers[32]  = {};
+    /* borrowed from the server while a request is read or served, or a WebSocket frame is partially received */
+    char * _buffer = nullptr;
 
 private:
-    HttpRequest              _req    = {};
-    HttpResponse             _resp   = nullptr;
-    const HttpRoutingTable * _routes = nullptr;
+    HttpArena    _arena  = {};
+    HttpRequest  _req    = {};
+    HttpResponse _resp   = nullptr;
+    HttpServer * _server = nullptr;
 
 public:
-    explicit HttpServer(uint16_t port, const HttpRoutingTable *routes);
+    HttpConnection();
 
 public:
     void poll();
-    void begin();
-    void close();
+    bool idle() const { return _state == State::Idle; }
+
+public:
+    /* waiting for the next request with nothing of it read yet, the slot can be taken back without losing work */
+    bool parked() const { return _state == State::ReadHeaders && _read_len == 0; }
 
 private:
-    bool accept(WiFiClient conn);
+    void accept(WiFiClient conn);
+    void fail(uint16_t code);
     void respond(HttpResponse &&resp);
+    void upgrade(HttpWebSocket &ws);
+    bool flush_chunk();
+    bool drain_body(size_t len);
+    void produce_chunk();
+    void accept_request(bool close);
+    bool overdue();
+
+private:
+    fs::File open_file();
+
+private:
+    bool borrow_buffer();
+    void return_buffer();
+
+private:
+    bool subscribed() const { return _ws != nullptr || _resp.events != nullptr; }
+
+private:
+    void   ws_send(byte opcode, const char *buf, size_t len);
+    void   ws_close(uint16_t code);
+    void   ws_batch();
+    size_t ws_frame();
 
 private:
     void state_finished();
     void state_read_headers();
     void state_read_payload();
+    void state_read_chunked();
+    void state_write_file();
+    void state_write_stream();
+    void state_write_events();
+    void state_websocket();
     void state_write_response();
     void state_handle_request();
 };
 
+class HttpServer {
+    friend class HttpConnection;
+
+private:
+    static_assert(HTTP_MAX_SUBSCRIBERS < HTTP_MAX_CONNS, "a connection slot must be left for plain requests");
+    static_assert(HTTP_MAX_BUFFERS <= 32, "free buffers are tracked in a 32-bit mask");
+
+private:
+    WiFiServer     _srv;
+    size_t         _next = 0;
+    HttpStats      _stats;
+    HttpRouter     _router;
+    HttpConnection _conns[HTTP_MAX_CONNS];
+
+private:
+    /* parked connections and event streams hold no request buffer, so there are fewer buffers than slots,
+     * and only one request is parsed at a time, so the header array is shared by all of them */
+    uint32_t   _free = (1ull << HTTP_MAX_BUFFERS) - 1;
+    char       _buffers[HTTP_MAX_BUFFERS][HTTP_BUFFER_SIZE] = {};
+    phr_header _headers[HTTP_MAX_HEADERS] = {};
+
+private:
+    fs::FS *          _fs;
+    const HttpBundle *_bundle;
+
+public:
+    /* paths without a route are served from `bundle`, then from `fs`, when they are not null */
+    explicit HttpServer(
+        uint16_t                 port,
+        const HttpRoutingTable * routes,
+        const HttpBundle *       bundle = nullptr,
+        fs::FS *                 fs     = nullptr
+    );
+
+public:
+    void poll();
+    void begin();
+    void close();
+
+public:
+    const HttpStats &stats() const { return _stats; }
+    void             reset_stats()  { _stats = HttpStats(); }
+
+private:
+    bool   accept(WiFiClient conn);
+    size_t subscribers() const;
+
+private:
+    char *borrow();
+    void  give_back(char *buf);
+};
+
 #endif
\ No newline at end of file
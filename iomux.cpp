@@ -1,125 +1,181 @@
-#include <SPI.h>
 #include "iomux.h"
 
 #define CS      15
 #define RST     16
+#define IRQ     4
 
-enum Register {
-    RHRTHR  = 0x00,     // Receive / Transmit Holding Register
-    IER     = 0x01,     // Interrupt Enable Register
-    IIRFCR  = 0x02,     // Interrupt Identification Register / FIFO Control Register
-    LCR     = 0x03,     // Line Control Register
-    MCR     = 0x04,     // Modem Control Register
-    LSR     = 0x05,     // Line Status Register
-    MSR     = 0x06,     // Modem Status Register
-    SPR     = 0x07,     // Scratchpad Register
-    TCR     = 0x06,     // Transmission Control Register
-    TLR     = 0x07,     // Trigger Level Register
-    TXLVL   = 0x08,     // Transmit FIFO Level Register
-    RXLVL   = 0x09,     // Receive FIFO Level Register
-    IODIR   = 0x0a,     // I/O pin Direction Register
-    IODATA  = 0x0b,     // I/O pin States Register
-    IOINTEN = 0x0c,     // I/O Interrupt Enable Register
-    IOCTRL  = 0x0e,     // I/O pins Control Register
-    EFCR    = 0x0f,     // Extra Features Register
-    DLL     = 0x00,     // Divisor Latch LSB
-    DLH     = 0x01,     // Divisor Latch MSB
-    EFR     = 0x02,     // Enhanced Feature Register
-    XON1    = 0x04,     // XON1 Word
-    XON2    = 0x05,     // XON2 Word
-    XOFF1   = 0x06,     // XOFF1 Word
-    XOFF2   = 0x07,     // XOFF2 Word
-};
-
-struct RegAddr {
-    byte addr;
-    RegAddr(Register reg, byte rw) : addr((rw << 7) | (reg << 3)) {}
-};
-
-static byte _dir = 0;
-static byte _pin = 0;
-static byte _int = 0;
-
-static byte reg_io(RegAddr ra, byte data = 0x00) {
-    byte buf[2] = { ra.addr, data };
-    digitalWrite(CS, LOW);
-    SPI.transferBytes(buf, buf, 2);
-    digitalWrite(CS, HIGH);
-    return buf[1];
-}
-
-static byte reg_read(Register reg) {
-    return reg_io(RegAddr(reg, 1));
-}
-
-static byte reg_write(Register reg, byte data) {
-    return reg_io(RegAddr(reg, 0), data);
+uint32_t IoMuxBase::_clock = 0;
+
+static IoMux<CS, RST, 20000000> _iomux;
+
+void IRAM_ATTR IoMuxBase::isr(void *arg) {
+    auto     dev  = static_cast<IoMuxBase *>(arg);
+    uint32_t head = dev->_irq_head;
+
+    /* the pin states are read by the task, a full queue only loses the timestamp */
+    if (head - dev->_irq_tail == IOMUX_IRQ_QUEUE) {
+        dev->_irq_lost = dev->_irq_lost + 1;
+    } else {
+        dev->_irq_time[head & (IOMUX_IRQ_QUEUE - 1)] = micros();
+        dev->_irq_head = head + 1;
+    }
+
+    /* wake the task, SPI must not be touched from here */
+    sched_notify(dev->_irq_task);
+}
+
+bool IoMuxBase::irq_attach(int pin, int task, IomuxHandler handler) {
+    if (sched_stats(task) == nullptr) {
+        return false;
+    }
+
+    /* the task is woken on every falling edge */
+    _handler = handler;
+    _irq_pin = pin;
+    _irq_task = task;
+
+    /* the IRQ output is open-drain and active low */
+    pinMode(pin, INPUT_PULLUP);
+    attachInterruptArg(digitalPinToInterrupt(pin), isr, this, FALLING);
+    return true;
+}
+
+uint32_t IoMuxBase::irq_take() {
+    uint32_t head = _irq_head;
+    uint32_t tail = _irq_tail;
+    uint32_t time = head == tail ? micros() : _irq_time[tail & (IOMUX_IRQ_QUEUE - 1)];
+
+    /* consume the queue, one pass covers all of it */
+    _irq_tail = head;
+    _stats.irqs += head - tail;
+    _stats.lost = _irq_lost;
+    return time;
+}
+
+bool IoMuxBase::irq_pending() const {
+    return _irq_pin >= 0 && digitalRead(_irq_pin) == LOW;
+}
+
+size_t IoMuxBase::rx_push(const byte *buf, size_t len) {
+    size_t n = std::min<size_t>(len, IOMUX_UART_RX_RING - (_rx_head - _rx_tail));
+
+    /* copy into the ring */
+    for (size_t i = 0; i < n; i++) {
+        _rx_ring[_rx_head++ & (IOMUX_UART_RX_RING - 1)] = buf[i];
+    }
+
+    /* number of bytes stored */
+    return n;
+}
+
+size_t IoMuxBase::rx_pop(byte *buf, size_t len) {
+    size_t n = std::min<size_t>(len, _rx_head - _rx_tail);
+
+    /* copy out of the ring */
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = _rx_ring[_rx_tail++ & (IOMUX_UART_RX_RING - 1)];
+    }
+
+    /* number of bytes taken */
+    return n;
+}
+
+size_t IoMuxBase::tx_push(const byte *buf, size_t len) {
+    size_t n = std::min<size_t>(len, IOMUX_UART_TX_RING - (_tx_head - _tx_tail));
+
+    /* copy into the ring */
+    for (size_t i = 0; i < n; i++) {
+        _tx_ring[_tx_head++ & (IOMUX_UART_TX_RING - 1)] = buf[i];
+    }
+
+    /* number of bytes stored */
+    return n;
+}
+
+size_t IoMuxBase::tx_pop(byte *buf, size_t len) {
+    size_t n = std::min<size_t>(len, _tx_head - _tx_tail);
+
+    /* copy out of the ring */
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = _tx_ring[_tx_tail++ & (IOMUX_UART_TX_RING - 1)];
+    }
+
+    /* number of bytes taken */
+    return n;
 }
 
 void iomux_init() {
-    SPI.begin();
-    SPI.setFrequency(20000000);
-    pinMode(CS, OUTPUT);
-    pinMode(RST, OUTPUT);
-    iomux_reset();
+    _iomux.init();
 }
 
 void iomux_reset() {
-    digitalWrite(CS, HIGH);
-    digitalWrite(RST, LOW);
-    delay(100);
-    digitalWrite(RST, HIGH);
-    delay(100);
+    _iomux.reset();
+}
+
+void iomux_flush() {
+    _iomux.flush();
+}
 
-    /* software reset */
-    reg_write(IOCTRL, 0x80);
-    delay(100);
+void iomux_write_back(bool enable) {
+    _iomux.write_back(enable);
+}
 
-    /* initialize the I/O state */
-    reg_write(IODIR, 0x00);
-    reg_write(IOCTRL, 0x01);
-    reg_write(IODATA, 0x00);
-    reg_write(IOINTEN, 0x00);
+bool iomux_attach(int task, IomuxHandler handler) {
+    return _iomux.attach(IRQ, task, handler);
+}
 
-    /* read the current I/O state back */
-    _dir = reg_read(IODIR);
-    _pin = reg_read(IODATA);
-    _int = reg_read(IOINTEN);
+void iomux_service() {
+    _iomux.service();
 }
 
 void iomux_io_dir(byte dir) {
-    _dir = dir;
-    reg_write(IODIR, _dir);
-    reg_write(IODATA, _pin);
+    _iomux.io_dir(dir);
 }
 
 byte iomux_io_read() {
-    _pin = reg_read(IODATA);
-    return _pin;
+    return _iomux.io_read();
 }
 
 void iomux_io_write(byte data) {
-    _pin = data;
-    reg_write(IODATA, _pin);
+    _iomux.io_write(data);
 }
 
 void iomux_pin_dir(int pin, bool dir) {
-    _dir = _dir & ~(1 << pin) | (dir << pin);
-    reg_write(IODIR, _dir);
-    reg_write(IODATA, _pin);
+    _iomux.pin_dir(pin, dir);
 }
 
 bool iomux_pin_read(int pin) {
-    _pin = reg_read(IODATA);
-    return !!(_pin & (1 << pin));
+    return _iomux.pin_read(pin);
 }
 
 void iomux_pin_write(int pin, bool bit) {
-    _pin = _pin & ~(1 << pin) | (bit << pin);
-    reg_write(IODATA, _pin);
+    _iomux.pin_write(pin, bit);
 }
 
 void iomux_pin_toggle(int pin) {
-    _pin ^= 1 << pin;
-    reg_write(IODATA, _pin);
+    _iomux.pin_toggle(pin);
+}
+
+void iomux_pin_interrupt(int pin, bool enable) {
+    _iomux.pin_interrupt(pin, enable);
+}
+
+void iomux_uart_begin(uint32_t baud) {
+    _iomux.uart_begin(baud);
+}
+
+size_t iomux_uart_available() {
+    return _iomux.uart_available();
+}
+
+size_t iomux_uart_read(byte *buf, size_t len) {
+    return _iomux.uart_read(buf, len);
+}
+
+size_t iomux_uart_write(const byte *buf, size_t len) {
+    return _iomux.uart_write(buf, len);
+}
+
+const IomuxStats &iomux_stats() {
+    return _iomux.stats();
 }
\ No newline at end of file
@@ -1,9 +1,595 @@
 #ifndef __IOMUX_H__
 #define __IOMUX_H__
 
+#include <SPI.h>
+#include "scheduler.h"
+
+#define IOMUX_BATCH_SIZE    8
+#define IOMUX_IRQ_QUEUE     16
+
+#define IOMUX_UART_XTAL     14745600
+#define IOMUX_UART_FIFO     64
+#define IOMUX_UART_RX_RING  256
+#define IOMUX_UART_TX_RING  256
+#define IOMUX_UART_RX_LEVEL 32      // RX FIFO bytes that raise the interrupt, multiple of 4
+#define IOMUX_UART_TX_LEVEL 32      // TX FIFO spaces that raise the interrupt, multiple of 4
+
+struct IomuxStats {
+    uint32_t batches = 0;
+    uint32_t frames  = 0;
+    uint32_t irqs    = 0;
+    uint32_t lost    = 0;       // interrupts dropped because the queue was full
+    uint32_t merged  = 0;       // batched writes that replaced the one before them, a frame saved each
+    uint32_t rx      = 0;
+    uint32_t tx      = 0;
+
+public:
+    /* CPU cycles spent with the bus busy, CS assertion included */
+    uint64_t cycles = 0;
+};
+
+struct IomuxEvent {
+    uint32_t time;      // micros() of the first interrupt
+    byte     changed;   // input pins that changed since the last event
+    byte     state;     // input pin levels
+};
+
+typedef void (*IomuxHandler)(const IomuxEvent &ev);
+
+/* the parts that do not depend on the pins, shared by all the expanders */
+class IoMuxBase {
+protected:
+    enum Register : byte {
+        RHRTHR  = 0x00,     // Receive / Transmit Holding Register
+        IER     = 0x01,     // Interrupt Enable Register
+        IIRFCR  = 0x02,     // Interrupt Identification Register / FIFO Control Register
+        LCR     = 0x03,     // Line Control Register
+        MCR     = 0x04,     // Modem Control Register
+        LSR     = 0x05,     // Line Status Register
+        MSR     = 0x06,     // Modem Status Register
+        SPR     = 0x07,     // Scratchpad Register
+        TCR     = 0x06,     // Transmission Control Register
+        TLR     = 0x07,     // Trigger Level Register
+        TXLVL   = 0x08,     // Transmit FIFO Level Register
+        RXLVL   = 0x09,     // Receive FIFO Level Register
+        IODIR   = 0x0a,     // I/O pin Direction Register
+        IODATA  = 0x0b,     // I/O pin States Register
+        IOINTEN = 0x0c,     // I/O Interrupt Enable Register
+        IOCTRL  = 0x0e,     // I/O pins Control Register
+        EFCR    = 0x0f,     // Extra Features Register
+        DLL     = 0x00,     // Divisor Latch LSB
+        DLH     = 0x01,     // Divisor Latch MSB
+        EFR     = 0x02,     // Enhanced Feature Register
+        XON1    = 0x04,     // XON1 Word
+        XON2    = 0x05,     // XON2 Word
+        XOFF1   = 0x06,     // XOFF1 Word
+        XOFF2   = 0x07,     // XOFF2 Word
+    };
+
+protected:
+    /* registers that hold configuration in every bank, so only the last of back-to-back writes matters,
+     * writes to RHR/THR and FCR move or reset the FIFOs and IOCTRL resets the chip, those always go out */
+    static constexpr uint16_t CONFIG_REGS =
+        1 << IER | 1 << LCR | 1 << MCR | 1 << TCR | 1 << TLR | 1 << IODIR | 1 << IODATA | 1 << IOINTEN | 1 << EFCR;
+
+protected:
+    static_assert(!(CONFIG_REGS & (1 << RHRTHR | 1 << IIRFCR | 1 << IOCTRL)), "FIFO and reset writes must never be merged");
+
+protected:
+    struct RegAddr {
+        byte addr;
+        constexpr RegAddr(Register reg, byte rw, byte ch) : addr((rw << 7) | (reg << 3) | (ch << 1)) {}
+    };
+
+protected:
+    struct RegOp {
+        byte   addr;
+        byte   data;
+        byte * dest;
+    };
+
+protected:
+    static_assert((IOMUX_IRQ_QUEUE & (IOMUX_IRQ_QUEUE - 1)) == 0, "queue size must be a power of 2");
+    static_assert((IOMUX_UART_RX_RING & (IOMUX_UART_RX_RING - 1)) == 0, "ring size must be a power of 2");
+    static_assert((IOMUX_UART_TX_RING & (IOMUX_UART_TX_RING - 1)) == 0, "ring size must be a power of 2");
+
+protected:
+    /* the SPI clock last programmed, expanders with different clocks take turns on the bus */
+    static uint32_t _clock;
+
+protected:
+    IomuxStats _stats = {};
+
+protected:
+    /* single-producer / single-consumer queue of interrupt times, the ISR only ever
+     * moves `_irq_head` and the service task only ever moves `_irq_tail` */
+    volatile uint32_t _irq_head = 0;
+    volatile uint32_t _irq_tail = 0;
+    volatile uint32_t _irq_lost = 0;
+    volatile uint32_t _irq_time[IOMUX_IRQ_QUEUE] = {};
+
+protected:
+    int          _irq_pin  = -1;
+    int          _irq_task = -1;
+    IomuxHandler _handler  = nullptr;
+
+protected:
+    /* `_ier` shadows IER, the heads and tails are free-running byte sequence numbers */
+    bool     _uart    = false;
+    byte     _ier     = 0;
+    uint32_t _rx_head = 0;
+    uint32_t _rx_tail = 0;
+    uint32_t _tx_head = 0;
+    uint32_t _tx_tail = 0;
+    byte     _rx_ring[IOMUX_UART_RX_RING] = {};
+    byte     _tx_ring[IOMUX_UART_TX_RING] = {};
+
+public:
+    const IomuxStats &stats() const { return _stats; }
+
+public:
+    size_t uart_available() const { return _rx_head - _rx_tail; }
+
+protected:
+    bool     irq_attach(int pin, int task, IomuxHandler handler);
+    uint32_t irq_take();
+    bool     irq_pending() const;
+
+protected:
+    size_t rx_push(const byte *buf, size_t len);
+    size_t rx_pop(byte *buf, size_t len);
+    size_t tx_push(const byte *buf, size_t len);
+    size_t tx_pop(byte *buf, size_t len);
+
+private:
+    static void isr(void *arg);
+};
+
+/* one channel of an SC16IS7xx on the SPI bus, the I/O pins are shared by the
+ * channels of a dual-channel part and should be driven through one of them */
+template <int CS, int RST, uint32_t CLOCK, byte CH = 0>
+class IoMux : public IoMuxBase {
+    static_assert(CS >= 0 && CS < 16, "CS must be one of GPIO0 - GPIO15");
+    static_assert(CH < 2, "SC16IS7xx parts have at most two channels");
+
+private:
+    /* the chip takes one register per CS frame (the FIFO burst aside), so a batch saves the
+     * per-call overhead and back-to-back configuration rewrites, not the frames themselves */
+    class RegBatch {
+    private:
+        IoMux & _dev;
+        size_t  _count = 0;
+        RegOp   _ops[IOMUX_BATCH_SIZE];
+
+    public:
+        explicit RegBatch(IoMux &dev) : _dev(dev) {}
+        ~RegBatch() { run(); }
+
+    public:
+        RegBatch &read(Register reg, byte *dest);
+        RegBatch &write(Register reg, byte data);
+        void      run();
+    };
+
+private:
+    byte _dir = 0;
+    byte _pin = 0;
+    byte _int = 0;
+
+private:
+    bool _write_back = false;
+    bool _dirty_dir  = false;
+    bool _dirty_pin  = false;
+    byte _irq_last   = 0;
+
+public:
+    void init();
+    void reset();
+
+public:
+    /* in write-back mode pin changes only update the shadow registers,
+     * and reach the chip on the next flush() */
+    void flush();
+    void write_back(bool enable);
+
+public:
+    /* routes the chip's IRQ line on `pin` to `task`, an event task that must call service(),
+     * which in turn moves the UART data and reports the input pin changes to `handler`,
+     * fails without attaching anything if there is no such task */
+    bool attach(int pin, int task, IomuxHandler handler) { return irq_attach(pin, task, handler); }
+    void service();
+
+public:
+    void io_dir(byte dir)   { _dir = dir; io_sync(true); }
+    void io_write(byte data) { _pin = data; io_sync(false); }
+    byte io_read();
+
+public:
+    void pin_dir(int pin, bool dir)    { _dir = _dir & ~(1 << pin) | (dir << pin); io_sync(true); }
+    void pin_write(int pin, bool bit)  { _pin = _pin & ~(1 << pin) | (bit << pin); io_sync(false); }
+    void pin_toggle(int pin)           { _pin ^= 1 << pin; io_sync(false); }
+    bool pin_read(int pin)             { return !!(((_dir & (1 << pin)) ? _pin : io_read()) & (1 << pin)); }
+    void pin_interrupt(int pin, bool enable);
+
+public:
+    /* 8N1 on the serial channel, buffered both ways and driven by the IRQ line */
+    void   uart_begin(uint32_t baud);
+    size_t uart_read(byte *buf, size_t len);
+    size_t uart_write(const byte *buf, size_t len);
+
+private:
+    static constexpr byte addr(Register reg, byte rw) { return RegAddr(reg, rw, CH).addr; }
+
+private:
+    static void select();
+    static void deselect() { GPOS = 1 << CS; }
+
+private:
+    byte frame(byte addr, byte data);
+    byte reg_read(Register reg) { return frame(addr(reg, 1), 0x00); }
+    void reg_write(Register reg, byte data) { frame(addr(reg, 0), data); }
+    void reg_burst(Register reg, byte rw, byte *buf, size_t len);
+
+private:
+    void io_sync(bool dir);
+    void io_fetch() { _pin = reg_read(IODATA) & ~_dir | _pin & _dir; }
+    void uart_service();
+};
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+typename IoMux<CS, RST, CLOCK, CH>::RegBatch &IoMux<CS, RST, CLOCK, CH>::RegBatch::read(Register reg, byte *dest) {
+    if (_count == IOMUX_BATCH_SIZE) {
+        run();
+    }
+
+    /* the value is stored to `dest` when the batch runs */
+    _ops[_count++] = { addr(reg, 1), 0x00, dest };
+    return *this;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+typename IoMux<CS, RST, CLOCK, CH>::RegBatch &IoMux<CS, RST, CLOCK, CH>::RegBatch::write(Register reg, byte data) {
+    auto addr = IoMux::addr(reg, 0);
+    auto last = _count == 0 ? nullptr : &_ops[_count - 1];
+
+    /* a write right after another one to the same configuration register replaces it */
+    if (last != nullptr && last->addr == addr && (CONFIG_REGS >> reg & 1)) {
+        last->data = data;
+        _dev._stats.merged++;
+        return *this;
+    }
+
+    /* flush the full batch */
+    if (_count == IOMUX_BATCH_SIZE) {
+        run();
+    }
+
+    /* queue the write */
+    _ops[_count++] = { addr, data, nullptr };
+    return *this;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::RegBatch::run() {
+    if (_count == 0) {
+        return;
+    }
+
+    /* CS is driven through the GPIO set / clear registers, digitalWrite() is
+     * several times slower than the 16-bit frame itself at 20 MHz */
+    uint32_t cycles = ESP.getCycleCount();
+    for (size_t i = 0; i < _count; i++) {
+        select();
+        auto ret = SPI.transfer16((_ops[i].addr << 8) | _ops[i].data);
+        deselect();
+
+        /* store the read results */
+        if (_ops[i].dest != nullptr) {
+            *_ops[i].dest = static_cast<byte>(ret);
+        }
+    }
+
+    /* update the bus statistics */
+    _dev._stats.cycles += ESP.getCycleCount() - cycles;
+    _dev._stats.frames += _count;
+    _dev._stats.batches++;
+    _count = 0;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::select() {
+    if (_clock != CLOCK) {
+        _clock = CLOCK;
+        SPI.setFrequency(CLOCK);
+    }
+
+    /* assert CS */
+    GPOC = 1 << CS;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+byte IoMux<CS, RST, CLOCK, CH>::frame(byte addr, byte data) {
+    uint32_t cycles = ESP.getCycleCount();
+
+    /* a single register access, the address byte is a constant for a known register */
+    select();
+    auto ret = SPI.transfer16((addr << 8) | data);
+    deselect();
+
+    /* update the bus statistics */
+    _stats.cycles += ESP.getCycleCount() - cycles;
+    _stats.frames++;
+    _stats.batches++;
+    return static_cast<byte>(ret);
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::reg_burst(Register reg, byte rw, byte *buf, size_t len) {
+    uint32_t cycles = ESP.getCycleCount();
+
+    /* the FIFOs pop or push one byte per data byte within a single CS frame */
+    select();
+    SPI.transfer(addr(reg, rw));
+
+    /* read or write the data */
+    if (rw) {
+        SPI.transferBytes(nullptr, buf, len);
+    } else {
+        SPI.writeBytes(buf, len);
+    }
+
+    /* release the bus */
+    deselect();
+    _stats.cycles += ESP.getCycleCount() - cycles;
+    _stats.frames++;
+    _stats.batches++;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::io_sync(bool dir) {
+    if (_write_back) {
+        _dirty_dir |= dir;
+        _dirty_pin = true;
+        return;
+    }
+
+    /* write-through output changes are a single frame with a constant address */
+    if (!dir) {
+        reg_write(IODATA, _pin);
+        return;
+    }
+
+    /* direction changes rewrite the levels too */
+    RegBatch(*this).write(IODIR, _dir).write(IODATA, _pin);
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::init() {
+    SPI.begin();
+    _clock = 0;
+    pinMode(CS, OUTPUT);
+    pinMode(RST, OUTPUT);
+    reset();
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::reset() {
+    digitalWrite(CS, HIGH);
+    digitalWrite(RST, LOW);
+    delay(100);
+    digitalWrite(RST, HIGH);
+    delay(100);
+
+    /* software reset */
+    reg_write(IOCTRL, 0x80);
+    delay(100);
+
+    /* initialize the I/O state, and read it back */
+    RegBatch(*this)
+        .write(IODIR, 0x00)
+        .write(IOCTRL, 0x01)
+        .write(IODATA, 0x00)
+        .write(IOINTEN, 0x00)
+        .read(IODIR, &_dir)
+        .read(IODATA, &_pin)
+        .read(IOINTEN, &_int);
+
+    /* the shadows are in sync with the chip, and the UART is back to its defaults */
+    _irq_last = _pin & ~_dir;
+    _uart = false;
+    _dirty_dir = false;
+    _dirty_pin = false;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::flush() {
+    RegBatch batch(*this);
+
+    /* push the coalesced changes, at most one frame per register */
+    if (_dirty_dir) {
+        batch.write(IODIR, _dir);
+    }
+
+    /* output levels, written after the direction like before */
+    if (_dirty_pin) {
+        batch.write(IODATA, _pin);
+    }
+
+    /* the batch runs when it goes out of scope */
+    _dirty_dir = false;
+    _dirty_pin = false;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::write_back(bool enable) {
+    _write_back = enable;
+
+    /* leaving write-back mode, push whatever is pending */
+    if (!enable) {
+        flush();
+    }
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::service() {
+    uint32_t time = irq_take();
+
+    /* the UART goes first, its FIFOs are the ones that can overflow */
+    if (_uart) {
+        uart_service();
+    }
+
+    /* IODATA is only read with pin interrupts enabled */
+    if (_int != 0) {
+        io_fetch();
+
+        /* report the enabled inputs that changed, the read also cleared the interrupt */
+        byte in  = _pin & ~_dir;
+        byte chg = (in ^ _irq_last) & _int;
+        _irq_last = in;
+
+        /* notify the handler */
+        if (chg != 0 && _handler != nullptr) {
+            _handler({ time, chg, in });
+        }
+    }
+
+    /* another change came in before the reads, the line stays low and there will be no new edge */
+    if (irq_pending()) {
+        sched_notify(_irq_task);
+    }
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+byte IoMux<CS, RST, CLOCK, CH>::io_read() {
+    if (_dir != 0xff) {
+        io_fetch();
+    }
+    return _pin;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::pin_interrupt(int pin, bool enable) {
+    byte in = 0x00;
+    _int = _int & ~(1 << pin) | (enable << pin);
+
+    /* reading IODATA clears whatever was pending, and gives the baseline for the next change */
+    RegBatch(*this).write(IOINTEN, _int).read(IODATA, &in);
+    _pin = in & ~_dir | _pin & _dir;
+    _irq_last = _pin & ~_dir;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::uart_service() {
+    byte buf[IOMUX_UART_FIFO];
+    byte rxlvl = 0;
+    byte txlvl = 0;
+
+    /* both FIFO levels in one batch */
+    RegBatch(*this).read(RXLVL, &rxlvl).read(TXLVL, &txlvl);
+
+    /* drain the RX FIFO as far as the ring takes it */
+    size_t rx = std::min<size_t>(rxlvl, IOMUX_UART_RX_RING - (_rx_head - _rx_tail));
+    if (rx != 0) {
+        reg_burst(RHRTHR, 1, buf, rx);
+        rx_push(buf, rx);
+    }
+
+    /* the ring is full, stop the RX interrupt until the reader makes room */
+    if (rx < rxlvl && (_ier & 0x01)) {
+        _ier &= ~0x01;
+        reg_write(IER, _ier);
+    }
+
+    /* fill the TX FIFO with as much as it has room for */
+    size_t tx = tx_pop(buf, std::min<size_t>(txlvl, sizeof(buf)));
+    if (tx != 0) {
+        reg_burst(RHRTHR, 0, buf, tx);
+    }
+
+    /* nothing left to send, stop the TX interrupt */
+    if (_tx_head == _tx_tail && (_ier & 0x02)) {
+        _ier &= ~0x02;
+        reg_write(IER, _ier);
+    }
+
+    /* update the statistics */
+    _stats.rx += rx;
+    _stats.tx += tx;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+void IoMux<CS, RST, CLOCK, CH>::uart_begin(uint32_t baud) {
+    uint32_t div = (IOMUX_UART_XTAL + baud * 8) / (baud * 16);
+
+    /* start with empty rings */
+    _rx_head = _rx_tail = 0;
+    _tx_head = _tx_tail = 0;
+    _ier = 0x01;
+    _uart = true;
+
+    /* divisor latch, then EFR for the enhanced functions, then 8N1 */
+    RegBatch(*this)
+        .write(LCR, 0x80)
+        .write(DLL, div & 0xff)
+        .write(DLH, div >> 8)
+        .write(LCR, 0xbf)
+        .write(EFR, 0x10)
+        .write(LCR, 0x03);
+
+    /* trigger levels go through TLR, which is only reachable with MCR[2] set,
+     * then reset and enable the FIFOs and the RX interrupt */
+    RegBatch(*this)
+        .write(MCR, 0x04)
+        .write(TLR, (IOMUX_UART_RX_LEVEL / 4) << 4 | (IOMUX_UART_TX_LEVEL / 4))
+        .write(MCR, 0x00)
+        .write(IIRFCR, 0x07)
+        .write(IER, _ier);
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+size_t IoMux<CS, RST, CLOCK, CH>::uart_read(byte *buf, size_t len) {
+    size_t n = rx_pop(buf, len);
+
+    /* there is room again, resume the RX interrupt */
+    if (n != 0 && _uart && !(_ier & 0x01)) {
+        _ier |= 0x01;
+        reg_write(IER, _ier);
+    }
+
+    /* number of bytes read */
+    return n;
+}
+
+template <int CS, int RST, uint32_t CLOCK, byte CH>
+size_t IoMux<CS, RST, CLOCK, CH>::uart_write(const byte *buf, size_t len) {
+    size_t n = tx_push(buf, len);
+
+    /* the TX interrupt fires right away with room in the FIFO, and keeps it filled from there */
+    if (n != 0 && _uart && !(_ier & 0x02)) {
+        _ier |= 0x02;
+        reg_write(IER, _ier);
+    }
+
+    /* number of bytes queued */
+    return n;
+}
+
+/* the expander on the board, through the original free functions */
 void iomux_init();
 void iomux_reset();
 
+/* in write-back mode pin changes only update the shadow registers,
+ * and reach the chip on the next iomux_flush() */
+void iomux_flush();
+void iomux_write_back(bool enable);
+
+/* routes the chip's IRQ line to `task`, an event task that must call iomux_service(),
+ * which in turn moves the UART data and reports the input pin changes to `handler`,
+ * fails without attaching anything if there is no such task */
+bool iomux_attach(int task, IomuxHandler handler);
+void iomux_service();
+
 void iomux_io_dir(byte dir);
 byte iomux_io_read();
 void iomux_io_write(byte data);
@@ -12,5 +598,14 @@ void iomux_pin_dir(int pin, bool dir);
 bool iomux_pin_read(int pin);
 void iomux_pin_write(int pin, bool bit);
 void iomux_pin_toggle(int pin);
+void iomux_pin_interrupt(int pin, bool enable);
+
+/* 8N1 on the expander's serial channel, buffered both ways and driven by the IRQ line */
+void   iomux_uart_begin(uint32_t baud);
+size_t iomux_uart_available();
+size_t iomux_uart_read(byte *buf, size_t len);
+size_t iomux_uart_write(const byte *buf, size_t len);
+
+const IomuxStats &iomux_stats();
 
 #endif
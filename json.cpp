@@ -0,0 +1,216 @@
+#include "json.h"
+
+JsonWriter &JsonWriter::key(const char *name) {
+    string(name);
+    put(':');
+    _key = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::key_P(const char *name) {
+    char buf[32];
+    strncpy_P(buf, name, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    return key(buf);
+}
+
+JsonWriter &JsonWriter::null() {
+    next();
+    write("null", 4);
+    return *this;
+}
+
+JsonWriter &JsonWriter::boolean(bool val) {
+    next();
+    write(val ? "true" : "false", val ? 4 : 5);
+    return *this;
+}
+
+JsonWriter &JsonWriter::number(int32_t val) {
+    next();
+
+    /* the magnitude of INT32_MIN does not fit in int32_t */
+    if (val >= 0) {
+        digits(val, 1);
+    } else {
+        put('-');
+        digits(-static_cast<uint32_t>(val), 1);
+    }
+
+    /* chain the calls */
+    return *this;
+}
+
+JsonWriter &JsonWriter::number(uint32_t val) {
+    next();
+    digits(val, 1);
+    return *this;
+}
+
+JsonWriter &JsonWriter::string(std::string_view val) {
+    char        esc[6] = { '\\', 'u', '0', '0' };
+    const char *hex    = "0123456789abcdef";
+
+    /* copy the runs that need no escaping in one go */
+    next();
+    put('"');
+    for (size_t i = 0, p = 0; i <= val.size(); i++) {
+        if (i < val.size() && val[i] != '"' && val[i] != '\\' && static_cast<byte>(val[i]) >= 0x20) {
+            continue;
+        }
+
+        /* flush the plain run */
+        write(val.data() + p, i - p);
+        p = i + 1;
+
+        /* end of string */
+        if (i == val.size()) {
+            break;
+        }
+
+        /* escape the character */
+        switch (val[i]) {
+            case '"'  : write("\\\"", 2); break;
+            case '\\' : write("\\\\", 2); break;
+            case '\n' : write("\\n", 2); break;
+            case '\r' : write("\\r", 2); break;
+            case '\t' : write("\\t", 2); break;
+
+            /* other control characters */
+            default: {
+                esc[4] = hex[val[i] >> 4];
+                esc[5] = hex[val[i] & 15];
+                write(esc, sizeof(esc));
+                break;
+            }
+        }
+    }
+
+    /* close the string */
+    put('"');
+    return *this;
+}
+
+JsonWriter &JsonWriter::fixed(int32_t val, uint8_t scale) {
+    uint32_t div = 1;
+    uint32_t mag = val < 0 ? -static_cast<uint32_t>(val) : val;
+
+    /* 10^9 is the largest power of ten that fits */
+    scale = std::min<uint8_t>(scale, 9);
+    for (uint8_t i = 0; i < scale; i++) {
+        div *= 10;
+    }
+
+    /* the sign is written separately, so "-0.5" keeps it */
+    next();
+    if (val < 0) {
+        put('-');
+    }
+
+    /* integral part */
+    digits(mag / div, 1);
+
+    /* fractional part, zero-padded to the scale */
+    if (div != 1) {
+        put('.');
+        digits(mag % div, scale);
+    }
+
+    /* chain the calls */
+    return *this;
+}
+
+void JsonWriter::flush() {
+    if (_out != nullptr && _len != 0) {
+        _out->write(_buf, _len);
+        _len = 0;
+    }
+}
+
+size_t JsonWriter::drain(char *buf, size_t len) {
+    size_t n = std::min(len, _len);
+
+    /* move the staged bytes out, and shift the rest down */
+    memcpy(buf, _buf, n);
+    memmove(_buf, &_buf[n], _len - n);
+    _len -= n;
+    return n;
+}
+
+JsonWriter &JsonWriter::open(char ch) {
+    next();
+
+    /* too deeply nested */
+    if (_depth == JSON_MAX_DEPTH - 1) {
+        _overflow = true;
+        return *this;
+    }
+
+    /* going one level deeper */
+    put(ch);
+    _first |= 1u << ++_depth;
+    return *this;
+}
+
+JsonWriter &JsonWriter::close(char ch) {
+    if (_depth == 0) {
+        _overflow = true;
+    } else {
+        _depth--;
+        put(ch);
+    }
+
+    /* chain the calls */
+    return *this;
+}
+
+void JsonWriter::next() {
+    uint32_t bit = 1u << _depth;
+
+    /* values after a key need no separator */
+    if (_key) {
+        _key = false;
+        return;
+    }
+
+    /* separate from the previous value at the same depth */
+    if (_first & bit) {
+        _first &= ~bit;
+    } else {
+        put(',');
+    }
+}
+
+void JsonWriter::write(const char *buf, size_t len) {
+    if (_len + len > sizeof(_buf)) {
+        flush();
+    }
+
+    /* still no room without a sink */
+    if (_len + len > sizeof(_buf)) {
+        if (_out != nullptr) {
+            _out->write(buf, len);
+        } else {
+            _overflow = true;
+        }
+        return;
+    }
+
+    /* stage the bytes */
+    memcpy(&_buf[_len], buf, len);
+    _len += len;
+}
+
+void JsonWriter::digits(uint32_t val, uint8_t min) {
+    char   buf[10];
+    size_t pos = sizeof(buf);
+
+    /* generate the digits backwards */
+    do {
+        buf[--pos] = '0' + val % 10;
+        val /= 10;
+    } while (val != 0 || sizeof(buf) - pos < min);
+
+    /* write them out */
+    write(&buf[pos], sizeof(buf) - pos);
+}
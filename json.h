@@ -0,0 +1,65 @@
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <string_view>
+#include <Arduino.h>
+
+#define JSON_BUFFER_SIZE    128
+#define JSON_MAX_DEPTH      32
+
+/* emits JSON into a small staging buffer, which is either flushed to `out` (e.g. a WiFiClient) as it
+ * fills up, or pulled with drain() from an HttpProducer, in which case every value written between two
+ * drains must fit in JSON_BUFFER_SIZE, anything beyond that is dropped and overflow() becomes true */
+class JsonWriter {
+    Print *  _out      = nullptr;
+    size_t   _len      = 0;
+    uint8_t  _depth    = 0;
+    uint32_t _first    = 1;         // bit per depth, the next value is the first one at that depth
+    bool     _key      = false;     // a key was just written, so no separator is needed
+    bool     _overflow = false;
+    char     _buf[JSON_BUFFER_SIZE] = {};
+
+public:
+    explicit JsonWriter(Print *out = nullptr) : _out(out) {}
+
+public:
+    size_t pending()  const { return _len; }
+    bool   overflow() const { return _overflow; }
+
+public:
+    JsonWriter &begin_object() { return open('{'); }
+    JsonWriter &begin_array()  { return open('['); }
+    JsonWriter &end_object()   { return close('}'); }
+    JsonWriter &end_array()    { return close(']'); }
+
+public:
+    JsonWriter &key(const char *name);
+    JsonWriter &key_P(const char *name);
+
+public:
+    JsonWriter &null();
+    JsonWriter &boolean(bool val);
+    JsonWriter &number(int32_t val);
+    JsonWriter &number(uint32_t val);
+    JsonWriter &string(std::string_view val);
+
+public:
+    /* writes `val / 10^scale` without going through floating point, e.g. fixed(-1234, 2) is "-12.34" */
+    JsonWriter &fixed(int32_t val, uint8_t scale);
+
+public:
+    void   flush();
+    size_t drain(char *buf, size_t len);
+
+private:
+    JsonWriter &open(char ch);
+    JsonWriter &close(char ch);
+
+private:
+    void next();
+    void put(char ch) { write(&ch, 1); }
+    void write(const char *buf, size_t len);
+    void digits(uint32_t val, uint8_t min);
+};
+
+#endif
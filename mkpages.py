@@ -2,7 +2,8 @@
 # -*- coding: utf-8 -*-
 
 import os
-import re
+import gzip
+import hashlib
 import mimetypes
 
 from typing import Iterator
@@ -15,7 +16,77 @@ def walkdir(path: str) -> Iterator[str]:
         else:
             yield fname
 
+def hexdump(data: bytes) -> Iterator[str]:
+    while data:
+        buf, data = data[:16], data[16:]
+        yield '    ' + ''.join('0x%02x, ' % v for v in buf).strip()
+
+def cstring(val: bytes) -> str:
+    return '"%s"' % ''.join(cchar(v) for v in val)
+
+def cchar(v: int) -> str:
+    if v in b'"\\':
+        return '\\' + chr(v)
+    elif 0x20 <= v < 0x7f and v != ord('?'):
+        return chr(v)
+    else:
+        return '\\%03o' % v
+
+class Pool:
+    def __init__(self):
+        self.buf = b''
+        self.off = {}
+        self.ord = []
+
+    def add(self, val: bytes) -> int:
+        if val not in self.off:
+            # the index stores the offsets as uint16_t
+            if len(self.buf) > 0xffff:
+                raise ValueError('string pool is larger than 64 KiB at %r' % val)
+            self.ord.append(val)
+            self.off[val] = len(self.buf)
+            self.buf += val + b'\0'
+        return self.off[val]
+
 root = os.path.join(os.path.abspath(os.path.dirname(__file__)), 'pages')
+blob = b''
+pool = Pool()
+index = []
+
+for path in sorted(walkdir(root)):
+    rel = os.path.relpath(path, root).replace(os.sep, '/')
+    mtype, _ = mimetypes.guess_type(rel, strict = False)
+
+    if mtype is None:
+        mtype = 'application/octet-stream'
+
+    with open(path, 'rb') as fp:
+        data = fp.read()
+
+    # only keep the compressed variant when it is actually smaller,
+    # mtime is fixed so the output (and the ETag) is reproducible
+    comp = gzip.compress(data, compresslevel = 9, mtime = 0)
+    zipped = len(comp) < len(data)
+
+    if zipped:
+        data = comp
+
+    # the tag identifies the stored bytes
+    etag = b'"%s"' % hashlib.sha256(data).hexdigest()[:16].encode('utf-8')
+    names = ['/' + rel]
+
+    # directory indexes are also served under the directory itself
+    if os.path.basename(rel) == 'index.html':
+        names.append('/' + rel[:-len('index.html')])
+
+    # every name shares the same data, path lengths are uint16_t too
+    for name in names:
+        if len(name.encode('utf-8')) > 0xffff:
+            raise ValueError('path is longer than 64 KiB: %s' % name)
+        index.append((name.encode('utf-8'), pool.add(mtype.encode('utf-8')), pool.add(etag), len(blob), len(data), zipped))
+
+    blob += data
+
 lines = []
 lines.append('#ifndef __PAGES_H__')
 lines.append('#define __PAGES_H__')
@@ -24,37 +95,49 @@ lines.append('#include <stddef.h>')
 lines.append('#include <stdint.h>')
 lines.append('#include <sys/pgmspace.h>')
 lines.append('')
+lines.append('#include "httpserver.h"')
+lines.append('')
 
-for path in walkdir(root):
-    rel = os.path.relpath(path, root)
-    name = re.sub('[^A-Za-z0-9_]', '_', rel)
-    mtype, _ = mimetypes.guess_type(rel, strict = False)
-
-    if mtype is None:
-        mtype = 'application/octet-stream'
-
-    with open(path, 'rb') as fp:
-        buf = fp.read()
+# the index is searched with memcmp(), so sort by the raw bytes
+index.sort(key = lambda v: v[0])
+paths = [pool.add(v[0]) for v in index]
 
-    data = b''
-    data += b'HTTP/1.1 200 OK\r\n'
-    data += b'Server: feel-better-soon/1.0\r\n'
-    data += b'Content-Type: %s\r\n' % mtype.encode('utf-8')
-    data += b'Content-Length: %d\r\n' % len(buf)
-    data += b'\r\n'
-    data += buf
+# an empty pages directory makes an empty bundle, C++ has no zero-length arrays
+if not index:
+    lines.append('static const HttpBundle PagesBundle = {')
+    lines.append('    0,')
+    lines.append('    nullptr,')
+    lines.append('    nullptr,')
+    lines.append('    nullptr,')
+    lines.append('};')
+    lines.append('')
+else:
+    # strings are separated by explicit NULs, the literal adds the final one
+    lines.append('static const char PAGES_strings[] PROGMEM =')
+    lines.extend('    %s' % cstring(v + b'\0') for v in pool.ord[:-1])
+    lines.append('    %s;' % cstring(pool.ord[-1]))
+    lines.append('')
 
-    lines.append('// File: ' + rel)
-    lines.append('static const size_t SIZE_%s = %d;' % (name, len(data)))
-    lines.append('static const uint8_t DATA_%s[] PROGMEM = {' % name);
+    lines.append('static const uint8_t PAGES_data[] PROGMEM = {')
+    lines.extend(hexdump(blob))
+    lines.append('};')
+    lines.append('')
 
-    while data:
-        buf, data = data[:16], data[16:]
-        lines.append('    ' + ''.join('0x%02x, ' % v for v in buf).strip())
+    lines.append('static const HttpBundleEntry PAGES_index[] PROGMEM = {')
+    for off, (name, mtype, etag, offset, size, zipped) in zip(paths, index):
+        lines.append('    { %5d, %3d, %5d, %5d, %8d, %8d, %-5s },    // %s' % (
+            off, len(name), mtype, etag, offset, size, 'true' if zipped else 'false', name.decode('utf-8')))
+    lines.append('};')
+    lines.append('')
 
+    lines.append('static const HttpBundle PagesBundle = {')
+    lines.append('    sizeof(PAGES_index) / sizeof(PAGES_index[0]),')
+    lines.append('    PAGES_index,')
+    lines.append('    PAGES_strings,')
+    lines.append('    PAGES_data,')
     lines.append('};')
     lines.append('')
 
 with open('pages.h', 'w') as fp:
     lines.append('#endif')
-    fp.write('\n'.join(lines))
\ No newline at end of file
+    fp.write('\n'.join(lines))
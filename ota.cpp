@@ -0,0 +1,182 @@
+#include <Updater.h>
+#include <bearssl/bearssl_hash.h>
+
+#include "ota.h"
+
+static OtaStats          _stats  = {};
+static OtaStatus         _status = OtaStatus::Idle;
+static uint32_t          _since  = 0;
+static uint32_t          _touch  = 0;
+static const void *      _owner  = nullptr;
+static uint8_t           _last   = 0;
+static uint8_t           _digest[br_sha256_SIZE] = {};
+static br_sha256_context _sha    = {};
+
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    } else if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    } else if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    } else {
+        return -1;
+    }
+}
+
+static bool ota_fail(OtaStatus status) {
+    _status = status;
+    Update.end(false);
+    return false;
+}
+
+static void ota_track_heap() {
+    _stats.heap_min = std::min(_stats.heap_min, ESP.getFreeHeap());
+}
+
+bool ota_begin(const void *owner, size_t size, const char *sha256, size_t len) {
+    bool busy = _status == OtaStatus::Running && _owner != owner;
+
+    /* someone else is uploading, or the new image is waiting for the reboot */
+    if (busy || _status == OtaStatus::Done) {
+        return false;
+    }
+
+    /* restarted by the same uploader */
+    if (_status == OtaStatus::Running) {
+        Update.end(false);
+    }
+
+    /* reset the statistics */
+    _owner = owner;
+    _since = millis();
+    _touch = _since;
+    _stats = {};
+    _stats.size = size;
+    _stats.heap_start = ESP.getFreeHeap();
+    _stats.heap_min = _stats.heap_start;
+
+    /* parse the expected digest */
+    if (size == 0 || len != sizeof(_digest) * 2) {
+        _status = OtaStatus::BadRequest;
+        return false;
+    }
+
+    /* two hex digits per byte */
+    for (size_t i = 0; i < sizeof(_digest); i++) {
+        int hi = hex_value(sha256[i * 2]);
+        int lo = hex_value(sha256[i * 2 + 1]);
+
+        /* check for invalid digits */
+        if (hi < 0 || lo < 0) {
+            _status = OtaStatus::BadRequest;
+            return false;
+        }
+
+        /* store the byte */
+        _digest[i] = (hi << 4) | lo;
+    }
+
+    /* the image must fit into the free sketch space */
+    if (!Update.begin(size, U_FLASH)) {
+        _status = OtaStatus::NoSpace;
+        return false;
+    }
+
+    /* start hashing */
+    br_sha256_init(&_sha);
+    _status = OtaStatus::Running;
+    ota_track_heap();
+    return true;
+}
+
+bool ota_write(const void *buf, size_t len) {
+    auto ptr = static_cast<uint8_t *>(const_cast<void *>(buf));
+    auto end = _stats.written + len;
+
+    /* check for state and image size */
+    if (_status != OtaStatus::Running) {
+        return false;
+    } else if (end > _stats.size) {
+        return ota_fail(OtaStatus::BadRequest);
+    }
+
+    /* hash everything as it arrives */
+    _touch = millis();
+    br_sha256_update(&_sha, ptr, len);
+    _stats.written = end;
+
+    /* hold the last byte back, the image is incomplete (and never booted) until the digest is verified */
+    if (end == _stats.size) {
+        _last = ptr[--len];
+    }
+
+    /* write into the update partition */
+    if (Update.write(ptr, len) != len) {
+        return ota_fail(OtaStatus::FlashError);
+    }
+
+    /* track the heap usage while writing */
+    ota_track_heap();
+    return true;
+}
+
+bool ota_end() {
+    uint8_t dig[br_sha256_SIZE];
+
+    /* the whole image must have been received */
+    if (_status != OtaStatus::Running) {
+        return false;
+    } else if (_stats.written != _stats.size) {
+        return ota_fail(OtaStatus::BadRequest);
+    }
+
+    /* verify the digest */
+    br_sha256_out(&_sha, dig);
+    _stats.elapsed = millis() - _since;
+
+    /* the partial image is discarded on mismatch */
+    if (memcmp(dig, _digest, sizeof(dig)) != 0) {
+        return ota_fail(OtaStatus::Mismatch);
+    }
+
+    /* write the last byte and commit the image */
+    if (Update.write(&_last, 1) != 1 || !Update.end()) {
+        return ota_fail(OtaStatus::FlashError);
+    }
+
+    /* schedule the reboot */
+    _since = millis();
+    _status = OtaStatus::Done;
+    ota_track_heap();
+    return true;
+}
+
+void ota_poll() {
+    if (_status == OtaStatus::Done && millis() - _since >= OTA_REBOOT_DELAY) {
+        ESP.restart();
+    }
+
+    /* the uploader went away, let the next one in */
+    if (_status == OtaStatus::Running && millis() - _touch >= OTA_STALL_TIMEOUT) {
+        ota_fail(OtaStatus::BadRequest);
+    }
+}
+
+OtaStatus ota_status() {
+    return _status;
+}
+
+void ota_release(const void *owner) {
+    if (_owner == owner) {
+        _owner = nullptr;
+    }
+}
+
+const void *ota_owner() {
+    return _owner;
+}
+
+const OtaStats &ota_stats() {
+    return _stats;
+}
@@ -0,0 +1,45 @@
+#ifndef __OTA_H__
+#define __OTA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTA_REBOOT_DELAY    1000
+#define OTA_STALL_TIMEOUT   30000
+
+enum class OtaStatus : uint8_t {
+    Idle,
+    Running,
+    Done,
+    BadRequest,
+    NoSpace,
+    FlashError,
+    Mismatch,
+};
+
+struct OtaStats {
+    uint32_t size;
+    uint32_t written;
+    uint32_t elapsed;       // milliseconds from the first to the last byte
+    uint32_t heap_start;
+    uint32_t heap_min;
+};
+
+/* `sha256` is the expected digest of the whole image in hex, `owner` identifies the uploader, a running
+ * update of the same owner is aborted, one of another owner is left alone and the call fails */
+bool ota_begin(const void *owner, size_t size, const char *sha256, size_t len);
+bool ota_write(const void *buf, size_t len);
+
+/* verifies the digest and commits the image, the device reboots OTA_REBOOT_DELAY ms later in ota_poll(),
+ * which also aborts an update that received nothing for OTA_STALL_TIMEOUT ms */
+bool ota_end();
+void ota_poll();
+
+/* the owner is kept until released, so that a late request reusing the pointer is not mistaken for it */
+void ota_release(const void *owner);
+
+OtaStatus       ota_status();
+const void *    ota_owner();
+const OtaStats &ota_stats();
+
+#endif
@@ -26,6 +26,7 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #ifdef __SSE4_2__
 #ifdef _MSC_VER
@@ -50,8 +51,18 @@
 #define ALIGNED(n) __attribute__((aligned(n)))
 #endif
 
+#ifdef _MSC_VER
+#define ASSUME_ALIGNED(p, n) (p)
+#else
+#define ASSUME_ALIGNED(p, n) __builtin_assume_aligned(p, n)
+#endif
+
 #define IS_PRINTABLE_ASCII(c) ((unsigned char)(c)-040u < 0137u)
 
+/* Word-at-a-time test (SWAR) for targets without pcmpestri, non-zero iff any byte of `w` is below `n`, for `n` up to 0x80. It only
+ * tells whether a word holds a match, not where, so it is used to skip clean words and the exact byte is left to the byte loops. */
+#define SWAR_HAS_LESS(w, n) (((w)-0x01010101u * (n)) & ~(w)&0x80808080u)
+
 #define CHECK_EOF()                                                                                                                \
     if (buf == buf_end) {                                                                                                          \
         *ret = -2;                                                                                                                 \
@@ -131,6 +142,25 @@ static const char *findchar_fast(const char *buf, const char *buf_end, const cha
     return buf;
 }
 
+#ifndef __SSE4_2__
+/* returns a pointer at most 3 bytes before the first CR, LF or other byte below '\016', or near `buf_end` if there is none */
+static inline const char *skip_to_ctl(const char *buf, const char *buf_end)
+{
+    /* byte at a time up to the word boundary, word loads must be aligned on Xtensa */
+    for (; ((uintptr_t)buf & 3) != 0; ++buf) {
+        if (buf == buf_end || (unsigned char)*buf < '\016')
+            return buf;
+    }
+    for (; buf_end - buf >= 4; buf += 4) {
+        uint32_t w;
+        memcpy(&w, ASSUME_ALIGNED(buf, 4), 4);
+        if (SWAR_HAS_LESS(w, 016))
+            break;
+    }
+    return buf;
+}
+#endif
+
 static const char *get_token_to_eol(const char *buf, const char *buf_end, const char **token, size_t *token_len, int *ret)
 {
     const char *token_start = buf;
@@ -200,6 +230,12 @@ static const char *is_complete(const char *buf, const char *buf_end, size_t last
     buf = last_len < 3 ? buf : buf + last_len - 3;
 
     while (1) {
+#ifndef __SSE4_2__
+        /* skip the words that can not hold a CR or LF, four bytes at a time */
+        if (ret_cnt == 0) {
+            buf = skip_to_ctl(buf, buf_end);
+        }
+#endif
         CHECK_EOF();
         if (*buf == '\015') {
             ++buf;
@@ -0,0 +1,150 @@
+#include <Arduino.h>
+#include "scheduler.h"
+
+struct Task {
+    SchedTask         fn;
+    uint8_t           prio;
+    bool              event;
+    uint32_t          period;
+    uint32_t          due;
+    uint32_t          iter;
+    volatile bool     pending;
+    volatile uint32_t woken;
+    SchedStats        stats;
+};
+
+static size_t   _count = 0;
+static uint32_t _iter  = 0;
+static Task     _tasks[SCHED_MAX_TASKS] = {};
+
+static int sched_add(const char *name, uint8_t prio, uint32_t period, bool event, SchedTask fn) {
+    if (_count == SCHED_MAX_TASKS) {
+        return -1;
+    }
+
+    /* initialize the task, periodic tasks are due right away */
+    auto &t = _tasks[_count];
+    t.fn = fn;
+    t.prio = prio;
+    t.event = event;
+    t.period = period;
+    t.due = micros();
+    t.stats.name = name;
+    return _count++;
+}
+
+static bool sched_ready(const Task &t, uint32_t now) {
+    if (t.iter == _iter) {
+        return false;
+    } else if (t.event) {
+        return t.pending;
+    } else {
+        return static_cast<int32_t>(now - t.due) >= 0;
+    }
+}
+
+static Task *sched_pick(uint32_t now) {
+    Task *ret = nullptr;
+
+    /* highest priority first, then the one waiting for the longest */
+    for (size_t i = 0; i < _count; i++) {
+        auto &t = _tasks[i];
+        auto  d = t.event ? t.woken : t.due;
+
+        /* check if the task is runnable */
+        if (!sched_ready(t, now)) {
+            continue;
+        }
+
+        /* compare with the current pick */
+        if (ret == nullptr || t.prio < ret->prio) {
+            ret = &t;
+        } else if (t.prio == ret->prio && static_cast<int32_t>(d - (ret->event ? ret->woken : ret->due)) < 0) {
+            ret = &t;
+        }
+    }
+
+    /* nothing is ready */
+    return ret;
+}
+
+int sched_periodic(const char *name, uint8_t prio, uint32_t period, SchedTask fn) {
+    return sched_add(name, prio, period, false, fn);
+}
+
+int sched_event(const char *name, uint8_t prio, SchedTask fn) {
+    return sched_add(name, prio, 0, true, fn);
+}
+
+void IRAM_ATTR sched_notify(int task) {
+    if (task < 0 || static_cast<size_t>(task) >= _count) {
+        return;
+    }
+
+    auto &t = _tasks[task];
+
+    /* keep the time of the first wake-up */
+    if (!t.pending) {
+        t.woken = micros();
+        t.pending = true;
+    }
+}
+
+void sched_run() {
+    uint32_t start = micros();
+    uint32_t now   = start;
+
+    /* every task runs at most once per iteration */
+    for (_iter++;; now = micros()) {
+        auto t = sched_pick(now);
+
+        /* nothing left to run */
+        if (t == nullptr) {
+            break;
+        }
+
+        /* out of budget, the rest has to wait for the next iteration */
+        if (now - start >= SCHED_BUDGET) {
+            for (; t != nullptr; t = sched_pick(now)) {
+                t->iter = _iter;
+                t->stats.deferred++;
+            }
+            break;
+        }
+
+        /* the lateness is measured from when the task became ready */
+        uint32_t late = now - (t->event ? t->woken : t->due);
+        t->iter = _iter;
+        t->pending = false;
+
+        /* run the task */
+        t->fn();
+        uint32_t run = micros() - now;
+
+        /* update the statistics */
+        t->stats.runs++;
+        t->stats.run_max = std::max(t->stats.run_max, run);
+        t->stats.run_total += run;
+        t->stats.late_max = std::max(t->stats.late_max, late);
+        t->stats.late_total += late;
+
+        /* schedule the next period, missed periods are skipped instead of run back-to-back */
+        if (!t->event) {
+            if (static_cast<int32_t>(now - (t->due += t->period)) >= 0) {
+                t->due = now + t->period;
+            }
+        }
+    }
+}
+
+size_t sched_count() {
+    return _count;
+}
+
+const SchedStats *sched_stats(int task) {
+    if (task < 0 || static_cast<size_t>(task) >= _count) {
+        return nullptr;
+    } else {
+        return &_tasks[task].stats;
+    }
+}
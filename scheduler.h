@@ -0,0 +1,36 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCHED_MAX_TASKS     8
+#define SCHED_BUDGET        10000       // microseconds spent in tasks per sched_run()
+
+typedef void (*SchedTask)();
+
+/* all times are in microseconds */
+struct SchedStats {
+    const char * name;
+    uint32_t     runs;
+    uint32_t     run_max;
+    uint64_t     run_total;
+    uint32_t     late_max;
+    uint64_t     late_total;
+    uint32_t     deferred;      // ready but postponed because the budget was spent
+};
+
+/* lower `prio` runs first, a periodic task with `period` of 0 runs on every sched_run() */
+int sched_periodic(const char *name, uint8_t prio, uint32_t period, SchedTask fn);
+int sched_event(const char *name, uint8_t prio, SchedTask fn);
+
+/* wakes an event task, safe to call from interrupts, ids that do not name a task are ignored */
+void sched_notify(int task);
+
+/* runs the ready tasks by priority, each at most once, until SCHED_BUDGET is spent */
+void sched_run();
+
+size_t            sched_count();
+const SchedStats *sched_stats(int task);
+
+#endif